@@ -0,0 +1,95 @@
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "async_bcast.hpp"
+#include "bench_args.hpp"
+
+int main(int argc, char** argv) {
+  // Elements contributed by each rank.
+  size_t count = find_size_arg(argc, argv, "-n", 100000);
+  size_t iterations = find_size_arg(argc, argv, "-i", 10);
+  // Allgatherv: rank r contributes (r % 4 + 1) * n / 4 elements.
+  bool varying = find_int_arg(argc, argv, "-v", false);
+  // Run the P broadcasts one after another instead of all at once.
+  bool serial = find_int_arg(argc, argv, "-serial", false);
+  char* tree_name = find_string_arg(argc, argv, "-tree", (char*) "binary_split");
+  size_t radix = find_size_arg(argc, argv, "-radix", 2);
+  bcast_tree tree;
+  tree.radix = radix;
+  if (!parse_tree_shape(tree_name, tree.shape)) {
+    fprintf(stderr, "Unknown tree shape %s\n", tree_name);
+    return 1;
+  }
+
+  upcxx::init();
+
+  int rank_me = upcxx::rank_me();
+  int total_rank = upcxx::rank_n();
+  int root = 0;
+
+  std::vector<size_t> counts(total_rank, count);
+  if (varying) {
+    for (int r = 0; r < total_rank; r++)
+      counts[r] = (r % 4 + 1) * count / 4;
+  }
+  std::vector<size_t> offsets(total_rank + 1, 0);
+  for (int r = 0; r < total_rank; r++)
+    offsets[r + 1] = offsets[r] + counts[r];
+
+  if(rank_me == root){
+    printf("================%s (%s)================\n", varying ? "Allgatherv" : "Allgather",
+           serial ? "serial" : "concurrent");
+  }
+
+  auto begin = std::chrono::high_resolution_clock::now();
+  async_broadcast<int> gather(offsets[total_rank], total_rank);
+  gather.tree = tree;
+  upcxx::barrier();
+  auto end = std::chrono::high_resolution_clock::now();
+  double setup_data = std::chrono::duration<double>(end - begin).count();
+
+  double duration = 0;
+  for (size_t it = 0; it < iterations; it++) {
+    // Every block differs per iteration, so stale data is caught.
+    std::vector<int> block(counts[rank_me], rank_me + (int) it);
+
+    begin = std::chrono::high_resolution_clock::now();
+    if (serial) {
+      std::copy(block.begin(), block.end(), gather.my_data() + offsets[rank_me]);
+      for (int r = 0; r < total_rank; r++) {
+        if (r == rank_me)
+          gather.local_flags()[r] = gather.generations[r] + 1;
+        gather.ibcast(r, r, offsets[r], counts[r]).wait();
+      }
+    } else {
+      std::vector<bcast_request<int>> requests = gather.iallgatherv(block.data(), counts);
+      wait_all(requests);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    duration += std::chrono::duration<double>(end - begin).count();
+
+    for (int r = 0; r < total_rank; r++) {
+      for (size_t i = offsets[r]; i < offsets[r + 1]; i++)
+        assert(gather.my_data()[i] == r + (int) it);
+    }
+    // Nobody overwrites a region before everyone has read it.
+    upcxx::barrier();
+  }
+
+  double total_setup_data = upcxx::reduce_one(setup_data, upcxx::op_fast_add, 0).wait();
+  double total_duration = upcxx::reduce_one(duration, upcxx::op_fast_add, 0).wait();
+
+  if (rank_me == root) {
+    printf("(0) \t Setup in \t %lf \t seconds in average.\n", total_setup_data / (double)total_rank);
+    printf("(1) \t Gathered %zu elements in \t %lf \t seconds in average.\n", offsets[total_rank],
+           total_duration / (double)total_rank / (double)iterations);
+  }
+
+  upcxx::finalize();
+  return 0;
+}
@@ -1,157 +1,55 @@
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <cstdio>
 #include <cassert>
+#include <memory>
+#include <string>
 #include <unistd.h>
 #include <thread> 
 
 #include <upcxx/upcxx.hpp>
 
-template <typename T>
-struct broadcast_data {
-  broadcast_data(size_t n) {
-    bcast_size = n;
-    root = 0;
-    left = 0;
-    right = upcxx::rank_n() - 1;
-    for (size_t i = 0; i < upcxx::rank_n(); i++) {
-      upcxx::global_ptr<T> ptr = nullptr;
-      if (upcxx::rank_me() == i) {
-        ptr = upcxx::new_array<T>(n);
-      }
-      ptr = upcxx::broadcast(ptr, i).wait();
-      data_ptrs.push_back(ptr);
-
-      upcxx::global_ptr<int> cptr = nullptr;
-      if (upcxx::rank_me() == i) {
-        cptr = upcxx::new_array<int>(1);
-        *cptr.local() = 0;
-      }
-      cptr = upcxx::broadcast(cptr, i).wait();
-      confirmation_ptrs.push_back(cptr);
-    }
-  }
-
-  // only meaningful called after get() is done
-  bool futures_done() {
-    std::vector<upcxx::future<>> temp;
-    for (size_t i = 0; i < futures.size(); i++){
-      if (!futures[i].ready()){
-        upcxx::progress();
-        temp.push_back(futures[i]);
-      }
-    }  
-    bool res = false;
-    if (temp.size() == 0)
-      res = true;
-    futures = temp;
-    return res;
-  }
-
-  void wait_data(){
-    while (check_ready() != true){
-      get();
-    }
-  }
-
-  void wait_issue(){
-    while (get() != true){
-    }
-  }
-
-  void wait_put(){
-    while (futures_done() != true){
-    }
-  }
-  
-  bool check_ready() {
-    if (upcxx::rget(confirmation_ptrs[upcxx::rank_me()]).wait() == 1)
-      return true;
-    else
-      return false;
-  }
-  
-  bool get() { 
-    if (left == right)
-      return true;
-    size_t mid = left + (right - left) / 2;
-    size_t dest = (root <= mid) ? right: left;
-
-    if (upcxx::rank_me() == root){ 
-      if (!check_ready()) { 
-        return false;
-      }
-      int flag = 1;
-      upcxx::future<> fut = upcxx::rput(my_data(), data_ptrs[dest], bcast_size)
-      .then([=](){
-          return upcxx::rput(&flag, confirmation_ptrs[dest], 1);
-        });
-      futures.push_back(fut);
-    }
-
-    if (upcxx::rank_me() <= mid && root <= mid){
-      root = root;
-      left = left;
-      right = mid;
-    }
-    else if (upcxx::rank_me() <= mid && root > mid){
-      root = dest;
-      left = left;
-      right = mid;
-    }
-    else if (upcxx::rank_me() > mid && root <= mid){
-      root = dest;
-      left = mid+1;
-      right = right;
-    }
-    else if  (upcxx::rank_me() > mid && root > mid){
-      root = root;
-      left = mid+1;
-      right = right;
-    }
-
-    return false;
-  }
-
-  void init_root(const std::vector<T>& data){
-      int flag = 1;
-      upcxx::rput(data.data(), data_ptrs[root], data.size()).wait();
-      upcxx::rput(&flag, confirmation_ptrs[root], 1).wait();
-  }
-
-  T* my_data() {
-    return data_ptrs[upcxx::rank_me()].local();
-  }
-
-  size_t bcast_size, left, right, root;
-  std::vector<upcxx::future<>> futures;
-  // Global pointers to data buffer for each process.
-  std::vector<upcxx::global_ptr<T>> data_ptrs;
-  // Global pointers to confirmation flag for each process.
-  std::vector<upcxx::global_ptr<int>> confirmation_ptrs;
-};
-
-int find_arg_idx(int argc, char** argv, const char* option) {
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], option) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-bool find_int_arg(int argc, char** argv, const char* option, bool default_value) {
-    int iplace = find_arg_idx(argc, argv, option);
-
-    if (iplace >= 0 && iplace < argc) {
-        return true;
-    }
-
-    return default_value;
-}
+#include "async_bcast.hpp"
+#include "bench_args.hpp"
+#include "compute_kernels.hpp"
 
 int main(int argc, char** argv) {
   bool kernel = find_int_arg(argc, argv, "-k", false);
+  // What -k runs: sleep, triad or dgemm (see compute_kernels.hpp), and
+  // its size: microseconds, triad doubles or DGEMM dimension.
+  char* kernel_name = find_string_arg(argc, argv, "-kernel", (char*) "sleep");
+  size_t sleep_usec = find_size_arg(argc, argv, "-sleep", 500000);
+  size_t triad_size = find_size_arg(argc, argv, "-triad", 1 << 21);
+  size_t dgemm_size = find_size_arg(argc, argv, "-dgemm", 256);
+  // Forward from a dedicated progress thread holding the master persona,
+  // leaving the main thread free to run the kernel. Needs
+  // UPCXX_THREADMODE=par (see the Makefile).
+  bool progress_thread = find_int_arg(argc, argv, "-p", false);
+  // Number of broadcasts posted at once, op i rooted at rank i % P and
+  // carried in its own region of one shared buffer.
+  size_t n_bcasts = find_size_arg(argc, argv, "-c", 1);
+  // Receive into, and send from, buffers allocated by the application.
+  bool zero_copy = find_int_arg(argc, argv, "-zero-copy", false);
+  // Forwarding tree shape (binary_split, knomial, kary, fibonacci) and radix.
+  char* tree_name = find_string_arg(argc, argv, "-tree", (char*) "binary_split");
+  size_t radix = find_size_arg(argc, argv, "-radix", 2);
+  // Limits on each rank's forwarding puts in flight, in puts and bytes
+  // (0: none).
+  size_t window_ops = find_size_arg(argc, argv, "-window", 64);
+  size_t window_bytes = find_size_arg(argc, argv, "-window-bytes", 16 << 20);
+  bcast_tree tree;
+  tree.radix = radix;
+  if (!parse_tree_shape(tree_name, tree.shape)) {
+    fprintf(stderr, "Unknown tree shape %s\n", tree_name);
+    return 1;
+  }
 
+  compute_kernel kernel_kind;
+  if (!overlap_kernel::parse(kernel_name, kernel_kind)) {
+    fprintf(stderr, "-kernel must be one of sleep, triad or dgemm, not %s\n", kernel_name);
+    return 1;
+  }
   upcxx::init();
 
   int rank_me = upcxx::rank_me();
@@ -163,58 +61,124 @@ int main(int argc, char** argv) {
   // to support broadcasts up to `bcast_size` ints.
   
   if(rank_me == root){
-    printf("=================Asyn Bcast================\n");
+    if (progress_thread)
+      printf("=========Asyn Bcast (progress thread)=======\n");
+    else
+      printf("=================Asyn Bcast================\n");
   }
 
   auto begin = std::chrono::high_resolution_clock::now();
   
-  broadcast_data<int> bcast(bcast_size);
+  upcxx::global_ptr<int> user_buffer = zero_copy ? upcxx::new_array<int>(n_bcasts * bcast_size) : nullptr;
+  async_broadcast<int> bcast(n_bcasts * bcast_size, n_bcasts, user_buffer);
+  bcast.tree = tree;
+  bcast.window.max_ops = window_ops;
+  bcast.window.max_bytes = window_bytes;
   upcxx::barrier();
 
   
   auto end = std::chrono::high_resolution_clock::now();
   double setup_data = std::chrono::duration<double>(end - begin).count();
 
-  if (rank_me == root) {
-    std::vector<int> data(bcast_size, 12);
-    bcast.init_root(data);  
+  for (size_t i = 0; i < n_bcasts; i++) {
+    if (rank_me == (int) (i % total_rank) && zero_copy) {
+      std::fill(user_buffer.local() + i * bcast_size, user_buffer.local() + (i + 1) * bcast_size, 12);
+      bcast.init_root(user_buffer + i * bcast_size, i);
+    } else if (rank_me == (int) (i % total_rank)) {
+      std::vector<int> data(bcast_size, 12);
+      bcast.init_root(data, i, i * bcast_size);  
+    }
   }
+
+  std::vector<bcast_request<int>> requests;
+  for (size_t i = 0; i < n_bcasts; i++)
+    requests.push_back(bcast.ibcast(i % total_rank, i, i * bcast_size, bcast_size));
   
-  bcast.wait_data();
-  end = std::chrono::high_resolution_clock::now();
-  double duration_data = std::chrono::duration<double>(end - begin).count();
-  // printf("(1) \t rank \t %d \t took \t %lf \t seconds until data is available\n", upcxx::rank_me(), duration);
+  overlap_kernel run_kernel(kernel_kind, triad_size, dgemm_size, (useconds_t) sleep_usec);
 
+  double duration_data = 0;
+  double duration_issue = 0;
+  double duration_put = 0;
+  double duration_kernel = 0;
   std::vector<std::thread> threads;
-  if (kernel){
-    threads.push_back(std::thread(usleep, 500000));
-  }
-  
-  bcast.wait_issue();
-  end = std::chrono::high_resolution_clock::now();
-  double duration_issue = std::chrono::duration<double>(end - begin).count();
-  // printf("(2) \t rank \t %d \t took \t %lf \t seconds until all rputs issued\n", upcxx::rank_me(), duration);
-  
-  bcast.wait_put();
-  end = std::chrono::high_resolution_clock::now();
-  double duration_put = std::chrono::duration<double>(end - begin).count();
-  // printf("(3) \t rank \t %d \t took \t %lf \t seconds until all work finished\n", upcxx::rank_me(), duration);
-  
-  /*
-  Thinking: User can actually determine the sequence of wait_put and kernel.join. 
-  If kernel is light, then kernel first and wait_put second would produce advantage.
-  If kernel is heavy, then kernel second and wait_put first would produce advantage.
-  */
-  double duration_kernel;
-  if (kernel){
+  // Held by the main thread again once the progress thread is done with it.
+  std::unique_ptr<upcxx::persona_scope> master_scope;
+
+  if (progress_thread) {
+    std::atomic<bool> data_ready(false);
+    upcxx::persona& master = upcxx::master_persona();
+    upcxx::liberate_master_persona();
+    threads.push_back(std::thread([&](){
+        upcxx::persona_scope scope(master);
+        for (auto& request : requests)
+          request.wait_data();
+        auto t = std::chrono::high_resolution_clock::now();
+        duration_data = std::chrono::duration<double>(t - begin).count();
+        data_ready = true;
+        for (auto& request : requests)
+          request.wait_issue();
+        t = std::chrono::high_resolution_clock::now();
+        duration_issue = std::chrono::duration<double>(t - begin).count();
+        wait_all(requests);
+        t = std::chrono::high_resolution_clock::now();
+        duration_put = std::chrono::duration<double>(t - begin).count();
+      }));
+
+    // The kernel runs here, uninterrupted, once the data is in.
+    while (!data_ready) {
+    }
+    if (kernel) {
+      run_kernel();
+      end = std::chrono::high_resolution_clock::now();
+      duration_kernel = std::chrono::duration<double>(end - begin).count();
+    }
     for (auto& th : threads){
       th.join();
     }
+    master_scope.reset(new upcxx::persona_scope(master));
+  } else {
+    for (auto& request : requests)
+      request.wait_data();
+    end = std::chrono::high_resolution_clock::now();
+    duration_data = std::chrono::duration<double>(end - begin).count();
+    // printf("(1) \t rank \t %d \t took \t %lf \t seconds until data is available\n", upcxx::rank_me(), duration);
+
+    if (kernel){
+      threads.push_back(std::thread(std::ref(run_kernel)));
+    }
+    
+    for (auto& request : requests)
+      request.wait_issue();
     end = std::chrono::high_resolution_clock::now();
-    duration_kernel = std::chrono::duration<double>(end - begin).count();
-    // printf("(3.5) \t rank \t %d \t took \t %lf \t seconds until kernel done\n", upcxx::rank_me(), duration);
+    duration_issue = std::chrono::duration<double>(end - begin).count();
+    // printf("(2) \t rank \t %d \t took \t %lf \t seconds until all rputs issued\n", upcxx::rank_me(), duration);
+    
+    wait_all(requests);
+    end = std::chrono::high_resolution_clock::now();
+    duration_put = std::chrono::duration<double>(end - begin).count();
+    // printf("(3) \t rank \t %d \t took \t %lf \t seconds until all work finished\n", upcxx::rank_me(), duration);
+    
+    /*
+    Thinking: User can actually determine the sequence of wait_all and kernel.join. 
+    If kernel is light, then kernel first and wait_all second would produce advantage.
+    If kernel is heavy, then kernel second and wait_all first would produce advantage.
+    */
+    if (kernel){
+      for (auto& th : threads){
+        th.join();
+      }
+      end = std::chrono::high_resolution_clock::now();
+      duration_kernel = std::chrono::duration<double>(end - begin).count();
+      // printf("(3.5) \t rank \t %d \t took \t %lf \t seconds until kernel done\n", upcxx::rank_me(), duration);
+    }
   }
 
+  // Share of this rank's forwarding (data received to all puts done) that
+  // ran while the kernel was running.
+  double hidden = 1;
+  if (kernel && duration_put > duration_data)
+    hidden = (std::min(duration_put, duration_kernel) - duration_data) / (duration_put - duration_data);
+
   upcxx::barrier();
   end = std::chrono::high_resolution_clock::now();
   double duration = std::chrono::duration<double>(end - begin).count();
@@ -224,6 +188,7 @@ int main(int argc, char** argv) {
   double total_duration_kernel = upcxx::reduce_one(duration_kernel, upcxx::op_fast_add, 0).wait();
   double total_duration_issue = upcxx::reduce_one(duration_issue, upcxx::op_fast_add, 0).wait();
   double total_duration_put = upcxx::reduce_one(duration_put, upcxx::op_fast_add, 0).wait();
+  double total_hidden = upcxx::reduce_one(hidden, upcxx::op_fast_add, 0).wait();
   
   if (rank_me == root) {
     printf("(0) \t Setup in \t %lf \t seconds in average.\n", total_setup_data / upcxx::rank_n());
@@ -232,10 +197,12 @@ int main(int argc, char** argv) {
     printf("(4) \t All work finished in \t %lf \t seconds in average.\n", total_duration_put / (double)total_rank);
     printf("(5) \t Kernel done in \t %lf \t seconds in average.\n", total_duration_kernel / (double)total_rank);
     printf("(6) \t Broadcast took \t %lf \t seconds.\n", duration);
+    if (kernel)
+      printf("(7) \t Forwarding hidden behind kernel \t %lf \t in average.\n", total_hidden / (double)total_rank);
   }
 
   
-  for (size_t i = 0; i < bcast_size; i++) {
+  for (size_t i = 0; i < n_bcasts * bcast_size; i++) {
     assert(bcast.my_data()[i] == 12);
   }
 
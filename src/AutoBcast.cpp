@@ -0,0 +1,97 @@
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <unistd.h>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bench_args.hpp"
+#include "broadcast_data.hpp"
+#include "bcast_model.hpp"
+
+int main(int argc, char** argv) {
+  bool kernel = find_int_arg(argc, argv, "-k", false);
+  size_t bcast_size = find_size_arg(argc, argv, "-n", 1000000);
+  // Cost model file: loaded if it exists, otherwise calibrated and written.
+  char* model_file = find_string_arg(argc, argv, "-m", nullptr);
+  // Repeated broadcasts on the same handle, with the root rotating.
+  size_t iterations = find_size_arg(argc, argv, "-i", 1);
+  // Largest broadcast, in bytes, that may use the LL protocol.
+  size_t ll_crossover = find_size_arg(argc, argv, "-ll", 4096);
+  upcxx::init();
+
+  bcast_model model;
+  if (model_file == nullptr || !model.load_all(model_file)) {
+    model = bcast_model::calibrate();
+    // A single rank has nothing to measure, so keep the defaults off disk.
+    if (model_file != nullptr && upcxx::rank_n() > 1 && upcxx::rank_me() == 0)
+      model.save(model_file);
+  }
+  model.ll_crossover = ll_crossover;
+  bcast_plan plan = model.choose<int>(bcast_size);
+
+  if(upcxx::rank_me() == 0){
+    printf("=================Auto Bcast==================\n");
+    printf("alpha %e s, beta %e s/B: %s", model.alpha, model.beta,
+           bcast_algorithm_name(plan.algorithm));
+    if (plan.segment_size > 0)
+      printf(" (segment %zu)", plan.segment_size);
+    if (plan.algorithm == bcast_algorithm::tree)
+      printf(" (radix %zu)", plan.radix);
+    printf("\n");
+  }
+
+  auto begin = std::chrono::high_resolution_clock::now();
+  broadcast_data<int> bcast(bcast_size, plan.segment_size);
+  bcast.tree.radix = plan.radix;
+  upcxx::barrier();
+
+  auto end = std::chrono::high_resolution_clock::now();
+  double setup_data = std::chrono::duration<double>(end - begin).count();
+
+  for (size_t it = 0; it < iterations; it++) {
+    size_t root = it % upcxx::rank_n();
+    if (upcxx::rank_me() == root) {
+      std::vector<int> data(bcast_size, 12 + it);
+      bcast.init_root(data, root);
+    }
+
+    bcast.broadcast(plan.algorithm, root).wait();
+
+    while (!bcast.check_ready()) {
+    }
+    assert(bcast.my_data()[bcast_size - 1] == 12 + (int) it);
+  }
+
+  end = std::chrono::high_resolution_clock::now();
+  double duration_data = std::chrono::duration<double>(end - begin).count() - setup_data;
+
+  double duration_kernel = 0;
+  if (kernel){
+    usleep(500000);
+    end = std::chrono::high_resolution_clock::now();
+    duration_kernel = std::chrono::duration<double>(end - begin).count();
+  }
+
+  upcxx::barrier();
+  end = std::chrono::high_resolution_clock::now();
+  double duration = std::chrono::duration<double>(end - begin).count();
+
+  double total_duration_data = upcxx::reduce_one(duration_data, upcxx::op_fast_add, 0).wait();
+  double total_duration_kernel = upcxx::reduce_one(duration_kernel, upcxx::op_fast_add, 0).wait();
+  double total_setup_data = upcxx::reduce_one(setup_data, upcxx::op_fast_add, 0).wait();
+
+  if (upcxx::rank_me() == 0) {
+    printf("(0) \t Setup in \t %lf \t seconds in average.\n", total_setup_data / upcxx::rank_n());
+    printf("(1) \t Data received in \t %lf \t seconds in average per broadcast.\n", total_duration_data / upcxx::rank_n() / iterations);
+    printf("(2) \t Kernel done in \t %lf \t seconds in average.\n", total_duration_kernel / upcxx::rank_n());
+    printf("(3) Broadcast took %lf seconds.\n", duration);
+  }
+
+  for (size_t i = 0; i < bcast_size; i++) {
+    assert(bcast.my_data()[i] == 12 + (int) iterations - 1);
+  }
+
+  upcxx::finalize();
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bcast_model.hpp"
+#include "bench_args.hpp"
+#include "bench_stats.hpp"
+#include "broadcast_data.hpp"
+
+// Time `iterations` broadcasts of `bytes` from `root` after `warmup`
+// untimed ones. Each sample is the slowest rank's time from the barrier to
+// having the data with its own forwarding done; only rank 0 gets them.
+// The root stages its payload before the barrier, so, as with MPI_bench's
+// MPI_Bcast, only the broadcast itself is timed (except for pull).
+// With `noise_usec`, one non-root rank per iteration sleeps that long
+// before joining in, like a core descheduled by the OS, and is left out
+// of the sample: it shows how much the others wait for it. Every rank's
+// puts in flight are bounded by `window`'s limits.
+std::vector<double> time_broadcasts(bcast_algorithm alg, size_t bytes, size_t segment_size,
+                                    size_t radix, size_t root, size_t warmup, size_t iterations,
+                                    size_t noise_usec, const put_window& window) {
+    broadcast_data<char> bcast(bytes, segment_size);
+    bcast.tree.radix = radix;
+    bcast.window = window;
+    std::vector<char> payload(upcxx::rank_me() == root ? bytes : 0, 12);
+    // A pull root cannot restage until every rank has opened the next
+    // broadcast (see release_pull_source), which they only do once timed.
+    bool stage_late = alg == bcast_algorithm::pull;
+    std::vector<double> samples;
+    for (size_t it = 0; it < warmup + iterations; it++) {
+        if (!stage_late)
+            bcast.init_root(payload, root);
+        upcxx::barrier();
+        auto begin = std::chrono::high_resolution_clock::now();
+        size_t late = (root + 1 + it * 7919) % upcxx::rank_n();
+        bool delayed = noise_usec > 0 && late != root && upcxx::rank_me() == late;
+        if (delayed)
+            usleep(noise_usec);
+        if (stage_late)
+            bcast.init_root(payload, root);
+        bcast.broadcast(alg, root).wait();
+        while (!bcast.check_ready()) {
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double t = delayed ? 0 : std::chrono::duration<double>(end - begin).count();
+        double slowest = upcxx::reduce_one(t, upcxx::op_fast_max, 0).wait();
+        if (it >= warmup)
+            samples.push_back(slowest);
+    }
+    assert(bcast.my_data()[bytes - 1] == 12);
+    upcxx::barrier();
+    return samples;
+}
+
+int main(int argc, char** argv) {
+  size_t min_bytes = find_size_arg(argc, argv, "-min", 8);
+  size_t max_bytes = find_size_arg(argc, argv, "-max", 64 << 20);
+  size_t warmup = find_size_arg(argc, argv, "-w", 2);
+  size_t iterations = find_size_arg(argc, argv, "-i", 10);
+  // Number of roots to try, spread evenly over the ranks.
+  size_t n_roots = find_size_arg(argc, argv, "-r", 1);
+  // Comma-separated algorithm names; all of them by default.
+  char* alg_list = find_string_arg(argc, argv, "-alg", nullptr);
+  // Cost model file for segment sizes; the defaults are used without one.
+  char* model_file = find_string_arg(argc, argv, "-m", nullptr);
+  // CSV is appended to, so runs at several rank counts share one file.
+  char* csv_file = find_string_arg(argc, argv, "-csv", nullptr);
+  char* json_file = find_string_arg(argc, argv, "-json", nullptr);
+  // Microseconds one rank per iteration starts late (see time_broadcasts).
+  size_t noise_usec = find_size_arg(argc, argv, "-noise", 0);
+  // Limits on each rank's puts in flight, in puts and bytes (0: none).
+  put_window window(find_size_arg(argc, argv, "-window", 64),
+                    find_size_arg(argc, argv, "-window-bytes", 16 << 20));
+  upcxx::init();
+
+  bcast_model model;
+  if (model_file != nullptr)
+    model.load_all(model_file);
+
+  size_t p = upcxx::rank_n();
+  n_roots = std::max<size_t>(1, std::min(n_roots, p));
+  std::vector<bench_result> results;
+
+  if (upcxx::rank_me() == 0) {
+    printf("===============Bcast Benchmark===============\n");
+    print_header();
+  }
+
+  for (size_t bytes : bench_sizes(min_bytes, max_bytes)) {
+    for (bcast_algorithm alg : parse_bcast_algorithms(alg_list)) {
+      // Past the LL buffers it would just be the tree broadcast again.
+      if (alg == bcast_algorithm::ll && bytes > ll_buffer_limit)
+        continue;
+      size_t segment_size = model.segment_size(alg, bytes, 1, p);
+      size_t radix = model.best_radix(bytes, p);
+      for (size_t i = 0; i < n_roots; i++) {
+        size_t root = i * p / n_roots;
+        std::vector<double> samples = time_broadcasts(alg, bytes, segment_size, radix,
+                                                      root, warmup, iterations, noise_usec,
+                                                      window);
+        if (upcxx::rank_me() == 0) {
+          results.push_back(summarize("upcxx", bcast_algorithm_name(alg), bytes, p,
+                                      root, samples));
+          print_result(results.back());
+        }
+      }
+    }
+  }
+
+  if (upcxx::rank_me() == 0) {
+    if (csv_file != nullptr && !write_csv(csv_file, results))
+      fprintf(stderr, "Could not write %s\n", csv_file);
+    if (json_file != nullptr && !write_json(json_file, results))
+      fprintf(stderr, "Could not write %s\n", json_file);
+  }
+
+  upcxx::finalize();
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bench_args.hpp"
+#include "bench_stats.hpp"
+#include "collective.hpp"
+
+// Time `iterations` broadcasts of `bytes` from rank 0 with one
+// configuration of collective<>, after `warmup` untimed ones. Each sample
+// is the slowest rank's time from the barrier to having the data with its
+// own forwarding done; only rank 0 gets them.
+template <typename Collective>
+std::vector<double> time_collective(size_t bytes, size_t warmup, size_t iterations) {
+    Collective bcast(bytes);
+    std::vector<char> payload(upcxx::rank_me() == 0 ? bytes : 0, 12);
+    std::vector<double> samples;
+    for (size_t it = 0; it < warmup + iterations; it++) {
+        upcxx::barrier();
+        auto begin = std::chrono::high_resolution_clock::now();
+        bcast.init_root(payload, 0);
+        bcast.broadcast(0);
+        bcast.wait();
+        auto end = std::chrono::high_resolution_clock::now();
+        double t = std::chrono::duration<double>(end - begin).count();
+        double slowest = upcxx::reduce_one(t, upcxx::op_fast_max, 0).wait();
+        if (it >= warmup)
+            samples.push_back(slowest);
+    }
+    assert(bcast.my_data()[bytes - 1] == 12);
+    upcxx::barrier();
+    return samples;
+}
+
+template <typename Collective>
+void run(const char* name, size_t bytes, size_t warmup, size_t iterations,
+         std::vector<bench_result>& results) {
+    std::vector<double> samples = time_collective<Collective>(bytes, warmup, iterations);
+    if (upcxx::rank_me() == 0) {
+        results.push_back(summarize("collective", name, bytes, upcxx::rank_n(), 0, samples));
+        print_result(results.back());
+    }
+}
+
+int main(int argc, char** argv) {
+  size_t min_bytes = find_size_arg(argc, argv, "-min", 8);
+  size_t max_bytes = find_size_arg(argc, argv, "-max", 64 << 20);
+  size_t warmup = find_size_arg(argc, argv, "-w", 2);
+  size_t iterations = find_size_arg(argc, argv, "-i", 10);
+  // CSV is appended to, so runs at several rank counts share one file.
+  char* csv_file = find_string_arg(argc, argv, "-csv", nullptr);
+  char* json_file = find_string_arg(argc, argv, "-json", nullptr);
+  upcxx::init();
+
+  std::vector<bench_result> results;
+  if (upcxx::rank_me() == 0) {
+    printf("============Collective Benchmark=============\n");
+    print_header();
+  }
+
+  for (size_t bytes : bench_sizes(min_bytes, max_bytes)) {
+    run<collective<char, binary_split_tree>>("binary_split", bytes, warmup, iterations, results);
+    run<collective<char, knomial_tree<2>>>("knomial2", bytes, warmup, iterations, results);
+    run<collective<char, knomial_tree<4>>>("knomial4", bytes, warmup, iterations, results);
+    run<collective<char, kary_tree<8>>>("kary8", bytes, warmup, iterations, results);
+    run<collective<char, fibonacci_tree<2>>>("fibonacci2", bytes, warmup, iterations, results);
+    run<collective<char, knomial_tree<4>, put_signal>>("knomial4_put", bytes, warmup,
+                                                       iterations, results);
+    run<collective<char, knomial_tree<4>, fused_signal, polled_progress>>("knomial4_polled", bytes,
+                                                                          warmup, iterations, results);
+  }
+
+  if (upcxx::rank_me() == 0) {
+    if (csv_file != nullptr && !write_csv(csv_file, results))
+      fprintf(stderr, "Could not write %s\n", csv_file);
+    if (json_file != nullptr && !write_json(json_file, results))
+      fprintf(stderr, "Could not write %s\n", json_file);
+  }
+
+  upcxx::finalize();
+  return 0;
+}
@@ -5,160 +5,134 @@
 
 #include <upcxx/upcxx.hpp>
 
-template <typename T>
-struct broadcast_data {
-  broadcast_data(size_t n) {
-    bcast_size = n;
-    for (size_t i = 0; i < upcxx::rank_n(); i++) {
-      upcxx::global_ptr<T> ptr = nullptr;
-      if (upcxx::rank_me() == i) {
-        ptr = upcxx::new_array<T>(n);
-      }
-      ptr = upcxx::broadcast(ptr, i).wait();
-      data_ptrs.push_back(ptr);
-
-      upcxx::global_ptr<int> cptr = nullptr;
-      if (upcxx::rank_me() == i) {
-        cptr = upcxx::new_array<int>(1);
-        *cptr.local() = 0;
-      }
-      cptr = upcxx::broadcast(cptr, i).wait();
-      confirmation_ptrs.push_back(cptr);
+#include "bench_args.hpp"
+#include "broadcast_data.hpp"
+
+// Broadcast `bcast_size` ints from rank 0 with `alg`, every put signaling
+// its receiver with `Signal`, and print the timings.
+template <typename Signal>
+void run(bcast_algorithm alg, size_t bcast_size, size_t segment_size, bool shared_buffer,
+         bool zero_copy, const bcast_tree& tree, bool kernel) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    upcxx::global_ptr<int> user_buffer = zero_copy ? upcxx::new_array<int>(bcast_size) : nullptr;
+    broadcast_data<int, no_trace, Signal> bcast(bcast_size, segment_size, shared_buffer, user_buffer);
+    bcast.tree = tree;
+    upcxx::barrier();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    double setup_data = std::chrono::duration<double>(end - begin).count();
+
+    if (upcxx::rank_me() == 0 && zero_copy) {
+        std::fill(user_buffer.local(), user_buffer.local() + bcast_size, 12);
+        bcast.init_root(user_buffer, 0);
+    } else if (upcxx::rank_me() == 0) {
+        std::vector<int> data(bcast_size, 12);
+        bcast.init_root(data, 0);
     }
-  }
 
-  // Broadcast vector `data` from process `root` to
-  // all other processes.
-  void broadcast_MST(size_t root, size_t left, size_t right) { 
-	  if (left == right)
-      return;
-    size_t mid = left + (right - left) / 2;
-    size_t dest = (root <= mid) ? right: left;
-
-    if (upcxx::rank_me() == root){ 
-      while (!check_ready()) { 
-        // incase we send before previous recursion has not finished putting
-      }
-      const T* data = my_data();
-      int flag = 1;
-      upcxx::rput(data, data_ptrs[dest], bcast_size).wait();
-      upcxx::rput(&flag, confirmation_ptrs[dest], 1).wait();
+    bcast.broadcast(alg, 0).wait();
+
+    while (!bcast.check_ready()) {
     }
 
-    if (upcxx::rank_me() <= mid && root <= mid)
-      broadcast_MST(root, left, mid);
-    else if (upcxx::rank_me() <= mid && root > mid)
-      broadcast_MST(dest, left, mid);
-    else if (upcxx::rank_me() > mid && root <= mid)
-      broadcast_MST(dest, mid+1, right);
-    else if  (upcxx::rank_me() > mid && root > mid)
-      broadcast_MST(root, mid+1, right);
-  }
+    end = std::chrono::high_resolution_clock::now();
+    double duration_data = std::chrono::duration<double>(end - begin).count();
 
-  bool check_ready() {
-    if (upcxx::rget(confirmation_ptrs[upcxx::rank_me()]).wait() == 1) {
-      return true;
-    } else {
-      return false;
+    double duration_kernel = 0;
+    if (kernel){
+        usleep(500000);
+        end = std::chrono::high_resolution_clock::now();
+        duration_kernel = std::chrono::duration<double>(end - begin).count();
     }
-  }
 
-  void init_root(const std::vector<T>& data, size_t root){
-    if (upcxx::rank_me() == root) {
-      int flag = 1;
-      upcxx::rput(data.data(), data_ptrs[root], data.size()).wait();
-      upcxx::rput(&flag, confirmation_ptrs[root], 1).wait();
-    }
-  }
+    upcxx::barrier();
+    end = std::chrono::high_resolution_clock::now();
+    double duration = std::chrono::duration<double>(end - begin).count();
 
-  T* my_data() {
-    return data_ptrs[upcxx::rank_me()].local();
-  }
+    double total_duration_data = upcxx::reduce_one(duration_data, upcxx::op_fast_add, 0).wait();
+    double total_duration_kernel = upcxx::reduce_one(duration_kernel, upcxx::op_fast_add, 0).wait();
+    double total_setup_data = upcxx::reduce_one(setup_data, upcxx::op_fast_add, 0).wait();
 
-  size_t bcast_size;
-  // Global pointers to data buffer for each process.
-  std::vector<upcxx::global_ptr<T>> data_ptrs;
-  // Global pointers to confirmation flag for each process.
-  std::vector<upcxx::global_ptr<int>> confirmation_ptrs;
-};
-
-int find_arg_idx(int argc, char** argv, const char* option) {
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], option) == 0) {
-            return i;
-        }
+    if (upcxx::rank_me() == 0) {
+        printf("(0) \t Setup in \t %lf \t seconds in average.\n", total_setup_data / upcxx::rank_n());
+        printf("(1) \t Data received in \t %lf \t seconds in average.\n", total_duration_data / upcxx::rank_n());
+        printf("(2) \t Kernel done in \t %lf \t seconds in average.\n", total_duration_kernel / upcxx::rank_n());
+        printf("(3) Broadcast took %lf seconds.\n", duration);
     }
-    return -1;
-}
 
-bool find_int_arg(int argc, char** argv, const char* option, bool default_value) {
-    int iplace = find_arg_idx(argc, argv, option);
-
-    if (iplace >= 0 && iplace < argc) {
-        return true;
+    for (size_t i = 0; i < bcast_size; i++) {
+        assert(bcast.my_data()[i] == 12);
     }
-
-    return default_value;
 }
 
 int main(int argc, char** argv) {
   bool kernel = find_int_arg(argc, argv, "-k", false);
+  // Segment size in elements for the pipelined broadcast; 0 disables it.
+  size_t segment_size = find_size_arg(argc, argv, "-s", 0);
+  bool scatter = find_int_arg(argc, argv, "-a", false);
+  // Inter-node MST among node leaders, then shared-memory copies.
+  bool hierarchical = find_int_arg(argc, argv, "-h", false);
+  // LL protocol: flags packed into the payload, one put per hop.
+  bool ll = find_int_arg(argc, argv, "-ll", false);
+  // Send each flag as its own put instead of riding on the payload.
+  bool separate_flags = find_int_arg(argc, argv, "-separate-flags", false);
+  // Keep one read-only copy per node that all its ranks read from.
+  bool shared_buffer = find_int_arg(argc, argv, "-shared-buffer", false);
+  // Receive into, and send from, a buffer allocated by the application.
+  bool zero_copy = find_int_arg(argc, argv, "-zero-copy", false);
+  // Tree shape (binary_split, knomial, kary, fibonacci) and its radix.
+  char* tree_name = find_string_arg(argc, argv, "-tree", nullptr);
+  size_t radix = find_size_arg(argc, argv, "-radix", 2);
+  bcast_tree tree;
+  tree.radix = radix;
+  if (tree_name != nullptr && !parse_tree_shape(tree_name, tree.shape)) {
+    fprintf(stderr, "Unknown tree shape %s\n", tree_name);
+    return 1;
+  }
   upcxx::init();
 
-  size_t bcast_size = 1000000;
+  size_t bcast_size = find_size_arg(argc, argv, "-n", 1000000);
+  if (scatter) {
+    // One slice per rank.
+    segment_size = (bcast_size + upcxx::rank_n() - 1) / upcxx::rank_n();
+  }
 
   // Initialize a broadcast "data structure"
   // to support broadcasts up to `bcast_size` ints.
   
   if(upcxx::rank_me() == 0){
-    printf("=================MST Bcast==================\n");
-  }
-
-  auto begin = std::chrono::high_resolution_clock::now();
-  broadcast_data<int> bcast(bcast_size);
-  upcxx::barrier();
-  
-  auto end = std::chrono::high_resolution_clock::now();
-  double setup_data = std::chrono::duration<double>(end - begin).count();
-
-  if (upcxx::rank_me() == 0) {
-    std::vector<int> data(bcast_size, 12);
-    bcast.init_root(data, 0);
-  }
-
-  bcast.broadcast_MST(0, 0, upcxx::rank_n()-1);
-
-  while (!bcast.check_ready()) {
+    if (shared_buffer)
+      printf("==========Node-Shared Buffer Bcast===========\n");
+    else if (ll)
+      printf("=================LL Bcast===================\n");
+    else if (scatter)
+      printf("===========Scatter-Allgather Bcast===========\n");
+    else if (tree_name != nullptr)
+      printf("=========Tree Bcast (%s, radix %zu)=========\n", tree_shape_name(tree.shape), radix);
+    else if (hierarchical)
+      printf("============Hierarchical MST Bcast============\n");
+    else if (segment_size > 0)
+      printf("=========Pipelined MST Bcast (%zu)==========\n", segment_size);
+    else
+      printf("=================MST Bcast==================\n");
   }
 
-  end = std::chrono::high_resolution_clock::now();
-  double duration_data = std::chrono::duration<double>(end - begin).count();
-
-  double duration_kernel = 0;
-  if (kernel){
-    usleep(500000);
-    end = std::chrono::high_resolution_clock::now();
-    duration_kernel = std::chrono::duration<double>(end - begin).count();
-  }
-
-  upcxx::barrier();
-  end = std::chrono::high_resolution_clock::now();
-  double duration = std::chrono::duration<double>(end - begin).count();
-
-  double total_duration_data = upcxx::reduce_one(duration_data, upcxx::op_fast_add, 0).wait();
-  double total_duration_kernel = upcxx::reduce_one(duration_kernel, upcxx::op_fast_add, 0).wait();
-  double total_setup_data = upcxx::reduce_one(setup_data, upcxx::op_fast_add, 0).wait();
-
-  if (upcxx::rank_me() == 0) {
-    printf("(0) \t Setup in \t %lf \t seconds in average.\n", total_setup_data / upcxx::rank_n());
-    printf("(1) \t Data received in \t %lf \t seconds in average.\n", total_duration_data / upcxx::rank_n());
-    printf("(2) \t Kernel done in \t %lf \t seconds in average.\n", total_duration_kernel / upcxx::rank_n());
-    printf("(3) Broadcast took %lf seconds.\n", duration);
-  }
-
-  for (size_t i = 0; i < bcast_size; i++) {
-    assert(bcast.my_data()[i] == 12);
-  }
+  bcast_algorithm alg = bcast_algorithm::mst;
+  if (ll)
+    alg = bcast_algorithm::ll;
+  else if (scatter)
+    alg = bcast_algorithm::scatter_allgather;
+  else if (hierarchical)
+    alg = bcast_algorithm::hierarchical;
+  else if (tree_name != nullptr)
+    alg = bcast_algorithm::tree;
+  else if (segment_size > 0)
+    alg = bcast_algorithm::pipelined;
+
+  if (separate_flags)
+    run<put_signal>(alg, bcast_size, segment_size, shared_buffer, zero_copy, tree, kernel);
+  else
+    run<fused_signal>(alg, bcast_size, segment_size, shared_buffer, zero_copy, tree, kernel);
 
   upcxx::finalize();
   return 0;
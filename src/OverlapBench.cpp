@@ -0,0 +1,161 @@
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bcast_model.hpp"
+#include "bench_args.hpp"
+#include "bench_stats.hpp"
+#include "broadcast_data.hpp"
+#include "compute_kernels.hpp"
+
+// The kernels with their working sets, allocated once up front.
+struct kernel_set {
+    triad_kernel triad;
+    dgemm_kernel dgemm;
+    size_t passes;
+    useconds_t sleep_usec;
+
+    // Run `kernel`. consume reads broadcast number `epoch` out of `bcast`,
+    // through pointers fetched here since this may run on another thread.
+    double run(compute_kernel kernel, const double* data, volatile uint64_t* flags,
+               uint64_t epoch, size_t n, size_t segment_size) {
+        switch (kernel) {
+            case compute_kernel::sleep: return sleep_kernel(sleep_usec);
+            case compute_kernel::triad: return triad.run();
+            case compute_kernel::dgemm: return dgemm.run();
+            case compute_kernel::consume:
+                return consume_segments(data, flags, epoch, n, segment_size, passes);
+        }
+        return 0;
+    }
+};
+
+// Slowest rank's time since `begin`, on rank 0.
+double slowest_since(std::chrono::high_resolution_clock::time_point begin) {
+    auto end = std::chrono::high_resolution_clock::now();
+    double t = std::chrono::duration<double>(end - begin).count();
+    return upcxx::reduce_one(t, upcxx::op_fast_max, 0).wait();
+}
+
+int main(int argc, char** argv) {
+  size_t bcast_size = find_size_arg(argc, argv, "-n", 1 << 20);
+  size_t iterations = find_size_arg(argc, argv, "-i", 5);
+  // Comma-separated algorithm and kernel names; all of them by default.
+  char* alg_list = find_string_arg(argc, argv, "-alg", nullptr);
+  char* kernel_list = find_string_arg(argc, argv, "-kernel", nullptr);
+  // Kernel sizes: triad doubles, DGEMM dimension, passes over the data.
+  size_t triad_size = find_size_arg(argc, argv, "-triad", 1 << 21);
+  size_t dgemm_size = find_size_arg(argc, argv, "-dgemm", 256);
+  size_t passes = find_size_arg(argc, argv, "-passes", 20);
+  size_t sleep_usec = find_size_arg(argc, argv, "-sleep", 100000);
+  char* model_file = find_string_arg(argc, argv, "-m", nullptr);
+  // Run consume on this thread through for_each_chunk, segment by segment
+  // as they arrive, instead of on a thread polling the flags.
+  bool stream = find_int_arg(argc, argv, "-stream", false);
+  upcxx::init();
+
+  bcast_model model;
+  if (model_file != nullptr)
+    model.load_all(model_file);
+
+  kernel_set kernels = {triad_kernel(triad_size, 10), dgemm_kernel(dgemm_size, 32, 1),
+                        passes, (useconds_t) sleep_usec};
+  size_t root = 0;
+  std::vector<double> payload(upcxx::rank_me() == root ? bcast_size : 0, 12);
+
+  if (upcxx::rank_me() == 0) {
+    printf("==============Overlap Benchmark==============\n");
+    printf("%-18s %-8s %12s %12s %12s %10s\n", "algorithm", "kernel", "comm(s)",
+           "compute(s)", "total(s)", "efficiency");
+  }
+
+  for (bcast_algorithm alg : parse_bcast_algorithms(alg_list)) {
+    if (alg == bcast_algorithm::ll && bcast_size * sizeof(double) > ll_buffer_limit)
+      continue;
+    size_t segment_size = model.segment_size(alg, bcast_size, sizeof(double), upcxx::rank_n());
+    broadcast_data<double> bcast(bcast_size, segment_size);
+    bcast.tree.radix = model.best_radix(bcast_size * sizeof(double), upcxx::rank_n());
+    double* data = bcast.my_data();
+    volatile uint64_t* flags = bcast.segment_flags();
+    // The root stages before the clock starts, so T_comm is the broadcast
+    // alone. A pull root cannot restage until every rank has opened the
+    // next broadcast (see release_pull_source), so it stages once timed.
+    bool stage_late = alg == bcast_algorithm::pull;
+
+    for (compute_kernel kernel : parse_compute_kernels(kernel_list)) {
+      std::vector<double> comm, compute, total;
+      for (size_t it = 0; it < iterations; it++) {
+        // Broadcast alone.
+        if (!stage_late)
+          bcast.init_root(payload, root);
+        upcxx::barrier();
+        auto begin = std::chrono::high_resolution_clock::now();
+        if (stage_late)
+          bcast.init_root(payload, root);
+        bcast.broadcast(alg, root).wait();
+        while (!bcast.check_ready()) {
+        }
+        comm.push_back(slowest_since(begin));
+
+        // Kernel alone; consume finds the data already there.
+        upcxx::barrier();
+        begin = std::chrono::high_resolution_clock::now();
+        kernels.run(kernel, data, flags, bcast.epoch, bcast_size, bcast.segment_size);
+        compute.push_back(slowest_since(begin));
+
+        // Both: the kernel on its own thread while this one drives the broadcast.
+        if (!stage_late)
+          bcast.init_root(payload, root);
+        upcxx::barrier();
+        begin = std::chrono::high_resolution_clock::now();
+        if (stage_late)
+          bcast.init_root(payload, root);
+        if (stream && kernel == compute_kernel::consume) {
+          // Ranks that forward still wait for their data in broadcast().
+          upcxx::future<> sent = bcast.broadcast(alg, root);
+          double sum = 0;
+          bcast.for_each_chunk([&](size_t offset, size_t count){
+              sum += consume_chunk(data, offset, count, passes);
+            });
+          sent.wait();
+          // Keep the passes from being optimized away.
+          volatile double checksum = sum;
+          (void) checksum;
+        } else {
+          uint64_t next = bcast.epoch + 1;
+          std::thread th([&](){
+              kernels.run(kernel, data, flags, next, bcast_size, bcast.segment_size);
+            });
+          bcast.broadcast(alg, root).wait();
+          while (!bcast.check_ready()) {
+          }
+          th.join();
+        }
+        total.push_back(slowest_since(begin));
+      }
+      assert(data[bcast_size - 1] == 12);
+
+      if (upcxx::rank_me() == 0) {
+        std::sort(comm.begin(), comm.end());
+        std::sort(compute.begin(), compute.end());
+        std::sort(total.begin(), total.end());
+        double t_comm = percentile(comm, 0.5);
+        double t_compute = percentile(compute, 0.5);
+        double t_total = percentile(total, 0.5);
+        // 1 when the broadcast is fully hidden, 0 when nothing overlaps.
+        double efficiency = 1 - (t_total - t_compute) / t_comm;
+        printf("%-18s %-8s %12.3e %12.3e %12.3e %10.3f\n", bcast_algorithm_name(alg),
+               compute_kernel_name(kernel), t_comm, t_compute, t_total, efficiency);
+      }
+    }
+    upcxx::barrier();
+  }
+
+  upcxx::finalize();
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bench_args.hpp"
+#include "bench_stats.hpp"
+#include "reduce_data.hpp"
+
+// Input of rank r at index i: small integers, so every sum is exact.
+double input_value(size_t r, size_t i) {
+    return (double) ((r + i) % 5 + 1);
+}
+
+double expected_value(reduce_op op, size_t p, size_t i) {
+    double v = input_value(0, i);
+    for (size_t r = 1; r < p; r++) {
+        double x = input_value(r, i);
+        v = (op == reduce_op::sum) ? v + x : (op == reduce_op::min) ? std::min(v, x) : std::max(v, x);
+    }
+    return v;
+}
+
+// Time `iterations` reductions of `count` doubles after `warmup` untimed
+// ones, with reduce_data (`alg` >= 0) or upcxx::reduce_all/reduce_one
+// (`alg` < 0). Rooted reductions go to rank 0. Each sample is the slowest
+// rank's time from the barrier to its result (or its part) being done;
+// only rank 0 gets them.
+std::vector<double> time_reductions(int alg, reduce_op op, bool rooted, size_t count,
+                                    size_t warmup, size_t iterations) {
+    size_t me = upcxx::rank_me();
+    size_t p = upcxx::rank_n();
+    reduce_data<double> reduce(count);
+    std::vector<double> input(count), output(count);
+    for (size_t i = 0; i < count; i++)
+        input[i] = input_value(me, i);
+    std::vector<double> samples;
+    for (size_t it = 0; it < warmup + iterations; it++) {
+        // The result replaces the input, so it is written back every time.
+        std::copy(input.begin(), input.end(), reduce.my_data());
+        upcxx::barrier();
+        auto begin = std::chrono::high_resolution_clock::now();
+        if (alg >= 0) {
+            reduce_algorithm a = (reduce_algorithm) alg;
+            reduce_request<double> request = rooted ? reduce.ireduce(op, a, 0) : reduce.iallreduce(op, a);
+            request.wait();
+        } else if (rooted) {
+            switch (op) {
+              case reduce_op::sum: upcxx::reduce_one(input.data(), output.data(), count, upcxx::op_fast_add, 0).wait(); break;
+              case reduce_op::min: upcxx::reduce_one(input.data(), output.data(), count, upcxx::op_fast_min, 0).wait(); break;
+              case reduce_op::max: upcxx::reduce_one(input.data(), output.data(), count, upcxx::op_fast_max, 0).wait(); break;
+            }
+        } else {
+            switch (op) {
+              case reduce_op::sum: upcxx::reduce_all(input.data(), output.data(), count, upcxx::op_fast_add).wait(); break;
+              case reduce_op::min: upcxx::reduce_all(input.data(), output.data(), count, upcxx::op_fast_min).wait(); break;
+              case reduce_op::max: upcxx::reduce_all(input.data(), output.data(), count, upcxx::op_fast_max).wait(); break;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double t = std::chrono::duration<double>(end - begin).count();
+        double slowest = upcxx::reduce_one(t, upcxx::op_fast_max, 0).wait();
+        if (it >= warmup)
+            samples.push_back(slowest);
+    }
+    if (!rooted || me == 0) {
+        const double* result = (alg >= 0) ? reduce.my_data() : output.data();
+        assert(result[0] == expected_value(op, p, 0));
+        assert(result[count - 1] == expected_value(op, p, count - 1));
+    }
+    upcxx::barrier();
+    return samples;
+}
+
+int main(int argc, char** argv) {
+  size_t min_bytes = find_size_arg(argc, argv, "-min", 8);
+  size_t max_bytes = find_size_arg(argc, argv, "-max", 64 << 20);
+  size_t warmup = find_size_arg(argc, argv, "-w", 2);
+  size_t iterations = find_size_arg(argc, argv, "-i", 10);
+  // sum, min or max, over doubles.
+  char* op_name = find_string_arg(argc, argv, "-op", (char*) "sum");
+  // Reduce to rank 0 instead of allreduce.
+  bool rooted = find_int_arg(argc, argv, "-rooted", false);
+  // CSV is appended to, so runs at several rank counts share one file.
+  char* csv_file = find_string_arg(argc, argv, "-csv", nullptr);
+  char* json_file = find_string_arg(argc, argv, "-json", nullptr);
+  reduce_op op;
+  if (!parse_reduce_op(op_name, op)) {
+    fprintf(stderr, "Unknown reduction %s\n", op_name);
+    return 1;
+  }
+  upcxx::init();
+
+  size_t p = upcxx::rank_n();
+  std::vector<bench_result> results;
+
+  if (upcxx::rank_me() == 0) {
+    printf("=========%s Benchmark (%s)=========\n", rooted ? "Reduce" : "Allreduce", op_name);
+    print_header();
+  }
+
+  // reduce_data's algorithms, then UPC++'s own collective (-1).
+  const int algs[] = {(int) reduce_algorithm::recursive_doubling, (int) reduce_algorithm::rabenseifner, -1};
+  for (size_t bytes : bench_sizes(std::max(min_bytes, sizeof(double)), max_bytes)) {
+    size_t count = bytes / sizeof(double);
+    for (int alg : algs) {
+      // Past its receive slots it would just be Rabenseifner again.
+      if (alg == (int) reduce_algorithm::recursive_doubling && bytes > rd_buffer_limit)
+        continue;
+      std::vector<double> samples = time_reductions(alg, op, rooted, count, warmup, iterations);
+      if (upcxx::rank_me() == 0) {
+        std::string name = (alg >= 0) ? reduce_algorithm_name((reduce_algorithm) alg)
+                                      : (rooted ? "reduce_one" : "reduce_all");
+        results.push_back(summarize("upcxx", name, count * sizeof(double), p, 0, samples));
+        print_result(results.back());
+      }
+    }
+  }
+
+  if (upcxx::rank_me() == 0) {
+    if (csv_file != nullptr && !write_csv(csv_file, results))
+      fprintf(stderr, "Could not write %s\n", csv_file);
+    if (json_file != nullptr && !write_json(json_file, results))
+      fprintf(stderr, "Could not write %s\n", json_file);
+  }
+
+  upcxx::finalize();
+  return 0;
+}
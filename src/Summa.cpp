@@ -0,0 +1,222 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "async_bcast.hpp"
+#include "bench_args.hpp"
+
+// Small integers, so every sum below is exact in double.
+double a_value(size_t i, size_t k) {
+  return (double) ((i + 2 * k) % 7);
+}
+
+double b_value(size_t k, size_t j) {
+  return (double) ((3 * k + j) % 5);
+}
+
+// C (m x n, row-major) += A (m x k, leading dimension lda) * B (k x n,
+// leading dimension ldb), `block` rows of C at a time, calling poll()
+// after each block so the next panel's broadcast keeps moving.
+template <typename Poll>
+void panel_gemm(const double* a, size_t lda, const double* b, size_t ldb, double* c,
+                size_t m, size_t n, size_t k, size_t block, Poll poll) {
+  for (size_t ii = 0; ii < m; ii += block) {
+    size_t i_end = std::min(ii + block, m);
+    for (size_t i = ii; i < i_end; i++) {
+      for (size_t kk = 0; kk < k; kk++) {
+        double aik = a[i * lda + kk];
+        for (size_t j = 0; j < n; j++)
+          c[i * n + j] += aik * b[kk * ldb + j];
+      }
+    }
+    poll();
+  }
+}
+
+int main(int argc, char** argv) {
+  // C = A * B with N x N matrices in blocks over a process grid.
+  size_t N = find_size_arg(argc, argv, "-n", 4096);
+  // Panel width: columns of A and rows of B broadcast per step.
+  size_t nb = find_size_arg(argc, argv, "-b", 64);
+  // Rows of C computed between polls of the next panel's broadcast.
+  size_t poll_rows = find_size_arg(argc, argv, "-poll", 16);
+  // Broadcast each panel just before it is used instead of one step ahead.
+  bool no_overlap = find_int_arg(argc, argv, "-no-overlap", false);
+  // Send A panels with rput_irregular, one run per row, instead of rput_strided.
+  bool irregular = find_int_arg(argc, argv, "-irregular", false);
+  char* tree_name = find_string_arg(argc, argv, "-tree", (char*) "binary_split");
+  size_t radix = find_size_arg(argc, argv, "-radix", 2);
+  bcast_tree tree;
+  tree.radix = radix;
+  if (!parse_tree_shape(tree_name, tree.shape)) {
+    fprintf(stderr, "Unknown tree shape %s\n", tree_name);
+    return 1;
+  }
+
+  upcxx::init();
+
+  int rank_me = upcxx::rank_me();
+  int total_rank = upcxx::rank_n();
+  int root = 0;
+
+  // Most square pr x pc grid; rank r is at row r / pc, column r % pc.
+  size_t pr = (size_t) std::sqrt((double) total_rank);
+  while (total_rank % pr != 0)
+    pr--;
+  size_t pc = total_rank / pr;
+  size_t my_row = rank_me / pc;
+  size_t my_col = rank_me % pc;
+
+  // Local blocks: A is mb x ka, B is kb x nl and C is mb x nl. A panel must
+  // sit within one column of the grid, and a B panel within one row.
+  size_t mb = N / pr, nl = N / pc, ka = N / pc, kb = N / pr;
+  if (N % pr != 0 || N % pc != 0 || nb == 0 || ka % nb != 0 || kb % nb != 0) {
+    if (rank_me == root)
+      fprintf(stderr, "N = %zu must split into panels of %zu over a %zu x %zu grid\n", N, nb, pr, pc);
+    upcxx::finalize();
+    return 1;
+  }
+
+  if(rank_me == root){
+    printf("==========SUMMA %zu x %zu grid (%s)==========\n", pr, pc,
+           no_overlap ? "no overlap" : "overlap");
+  }
+
+  auto begin = std::chrono::high_resolution_clock::now();
+
+  upcxx::team row_team = upcxx::world().split(my_row, my_col);
+  upcxx::team col_team = upcxx::world().split(my_col, my_row);
+
+  upcxx::global_ptr<double> A = upcxx::new_array<double>(mb * ka);
+  upcxx::global_ptr<double> B = upcxx::new_array<double>(kb * nl);
+  std::vector<double> C(mb * nl, 0);
+  for (size_t i = 0; i < mb; i++) {
+    for (size_t k = 0; k < ka; k++)
+      A.local()[i * ka + k] = a_value(my_row * mb + i, my_col * ka + k);
+  }
+  for (size_t k = 0; k < kb; k++) {
+    for (size_t j = 0; j < nl; j++)
+      B.local()[k * nl + j] = b_value(my_row * kb + k, my_col * nl + j);
+  }
+
+  double duration = 0;
+  double duration_wait = 0;
+  double setup_data = 0;
+  {
+    // Panels cycle through `slots` regions, one op id each. A slot is
+    // reused only once every rank of the team has finished the panel it
+    // last held, which with one panel of lookahead was two steps ago.
+    const size_t slots = 3;
+    async_broadcast<double> a_bcast(slots * mb * nb, slots, nullptr, row_team);
+    async_broadcast<double> b_bcast(slots * nb * nl, slots, nullptr, col_team);
+    a_bcast.tree = tree;
+    b_bcast.tree = tree;
+    size_t n_panels = N / nb;
+    std::vector<upcxx::future<>> finished(n_panels);
+
+    upcxx::barrier();
+    auto end = std::chrono::high_resolution_clock::now();
+    setup_data = std::chrono::duration<double>(end - begin).count();
+    begin = std::chrono::high_resolution_clock::now();
+
+    // Post the broadcasts of panel p: its columns of A along the grid row,
+    // from their owner's A block, and its rows of B down the grid column.
+    auto post = [&](size_t p) {
+      size_t s = p % slots;
+      size_t k0 = p * nb;
+      if (p >= slots)
+        finished[p - slots].wait();
+
+      size_t a_root = k0 / ka;
+      bcast_region a_region = bcast_region::strided(s * mb * nb, mb, nb, nb);
+      if (irregular)
+        a_region = bcast_region::irregular(a_region.as_runs());
+      if (my_col == a_root)
+        a_bcast.init_root(A + k0 % ka, s, bcast_region::strided(0, mb, nb, ka));
+
+      size_t b_root = k0 / kb;
+      if (my_row == b_root)
+        b_bcast.init_root(B + (k0 % kb) * nl, s);
+
+      std::vector<bcast_request<double>> requests;
+      requests.push_back(a_bcast.ibcast(a_root, s, a_region));
+      requests.push_back(b_bcast.ibcast(b_root, s, s * nb * nl, nb * nl));
+      return requests;
+    };
+
+    auto poll = [&](){
+        a_bcast.progress();
+        b_bcast.progress();
+      };
+
+    std::vector<bcast_request<double>> current, next;
+    if (!no_overlap)
+      current = post(0);
+    for (size_t p = 0; p < n_panels; p++) {
+      if (no_overlap)
+        current = post(p);
+      else if (p + 1 < n_panels)
+        next = post(p + 1);
+
+      auto t = std::chrono::high_resolution_clock::now();
+      for (auto& request : current)
+        request.wait_data();
+      end = std::chrono::high_resolution_clock::now();
+      duration_wait += std::chrono::duration<double>(end - t).count();
+
+      // Owners use the panel in place; the others use their copy.
+      size_t s = p % slots;
+      size_t k0 = p * nb;
+      bool a_owner = (my_col == k0 / ka);
+      bool b_owner = (my_row == k0 / kb);
+      const double* a = a_owner ? A.local() + k0 % ka : a_bcast.my_data() + s * mb * nb;
+      const double* b = b_owner ? B.local() + (k0 % kb) * nl : b_bcast.my_data() + s * nb * nl;
+      panel_gemm(a, a_owner ? ka : nb, b, nl, C.data(), mb, nl, nb, poll_rows, poll);
+
+      wait_all(current);
+      finished[p] = upcxx::when_all(upcxx::barrier_async(row_team), upcxx::barrier_async(col_team));
+      current = next;
+    }
+    for (auto& f : finished)
+      f.wait();
+
+    end = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration<double>(end - begin).count();
+  }
+
+  // Check a sample of C against the product computed directly.
+  size_t i_step = std::max<size_t>(1, mb / 8);
+  size_t j_step = std::max<size_t>(1, nl / 8);
+  for (size_t i = 0; i < mb; i += i_step) {
+    for (size_t j = 0; j < nl; j += j_step) {
+      double expected = 0;
+      for (size_t k = 0; k < N; k++)
+        expected += a_value(my_row * mb + i, k) * b_value(k, my_col * nl + j);
+      assert(C[i * nl + j] == expected);
+    }
+  }
+
+  double total_setup_data = upcxx::reduce_one(setup_data, upcxx::op_fast_add, 0).wait();
+  double total_duration = upcxx::reduce_one(duration, upcxx::op_fast_add, 0).wait();
+  double total_duration_wait = upcxx::reduce_one(duration_wait, upcxx::op_fast_add, 0).wait();
+  double max_duration = upcxx::reduce_one(duration, upcxx::op_fast_max, 0).wait();
+
+  if (rank_me == root) {
+    printf("(0) \t Setup in \t %lf \t seconds in average.\n", total_setup_data / (double)total_rank);
+    printf("(1) \t Multiply took \t %lf \t seconds in average.\n", total_duration / (double)total_rank);
+    printf("(2) \t Waiting for panels \t %lf \t seconds in average.\n", total_duration_wait / (double)total_rank);
+    printf("(3) \t Rate \t %lf \t GFLOP/s.\n", 2.0 * N * N * N / max_duration / 1e9);
+  }
+
+  upcxx::delete_array(A);
+  upcxx::delete_array(B);
+  row_team.destroy();
+  col_team.destroy();
+  upcxx::finalize();
+  return 0;
+}
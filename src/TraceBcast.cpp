@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bcast_trace.hpp"
+#include "bench_args.hpp"
+#include "broadcast_data.hpp"
+
+int main(int argc, char** argv) {
+  size_t bcast_size = find_size_arg(argc, argv, "-n", 1000000);
+  // Traced broadcasts, with the root rotating.
+  size_t iterations = find_size_arg(argc, argv, "-i", 4);
+  char* alg_name = find_string_arg(argc, argv, "-alg", (char*) "tree");
+  // Segment size in elements for the pipelined broadcast.
+  size_t segment_size = find_size_arg(argc, argv, "-s", 0);
+  char* tree_name = find_string_arg(argc, argv, "-tree", (char*) "binary_split");
+  size_t radix = find_size_arg(argc, argv, "-radix", 2);
+  // Chrome/Perfetto trace file (chrome://tracing or ui.perfetto.dev).
+  char* trace_file = find_string_arg(argc, argv, "-o", (char*) "bcast_trace.json");
+  bcast_tree tree;
+  tree.radix = radix;
+  if (!parse_tree_shape(tree_name, tree.shape)) {
+    fprintf(stderr, "Unknown tree shape %s\n", tree_name);
+    return 1;
+  }
+  const bcast_algorithm all[] = {bcast_algorithm::flat, bcast_algorithm::mst, bcast_algorithm::pipelined,
+                                 bcast_algorithm::scatter_allgather, bcast_algorithm::hierarchical,
+                                 bcast_algorithm::tree, bcast_algorithm::ll, bcast_algorithm::pull};
+  bool found = false;
+  bcast_algorithm alg = bcast_algorithm::tree;
+  for (bcast_algorithm a : all) {
+    if (strcmp(alg_name, bcast_algorithm_name(a)) == 0) {
+      alg = a;
+      found = true;
+    }
+  }
+  if (!found) {
+    fprintf(stderr, "Unknown algorithm %s\n", alg_name);
+    return 1;
+  }
+  upcxx::init();
+
+  int rank_me = upcxx::rank_me();
+  int total_rank = upcxx::rank_n();
+  if (alg == bcast_algorithm::scatter_allgather) {
+    // One slice per rank.
+    segment_size = (bcast_size + total_rank - 1) / total_rank;
+  }
+
+  if (rank_me == 0)
+    printf("=============Traced Bcast (%s)=============\n", bcast_algorithm_name(alg));
+
+  broadcast_data<int, hop_trace> bcast(bcast_size, segment_size);
+  bcast.tree = tree;
+  std::vector<int> data(bcast_size);
+  bcast.trace.start();
+
+  for (size_t it = 0; it < iterations; it++) {
+    size_t root = it % total_rank;
+    if (rank_me == (int) root) {
+      std::fill(data.begin(), data.end(), (int) it);
+      bcast.init_root(data, root);
+    }
+    bcast.broadcast(alg, root).wait();
+    while (!bcast.check_ready()) {
+    }
+    for (size_t i = 0; i < bcast_size; i++)
+      assert(bcast.my_data()[i] == (int) it);
+    // Broadcasts do not overlap, so each one's path stands alone.
+    upcxx::barrier();
+  }
+
+  trace_log log = gather_trace(bcast.trace);
+  if (rank_me == 0) {
+    printf("(0) \t %zu puts over %zu broadcasts recorded.\n", log.hops.size(), iterations);
+    log.print_critical_path();
+    if (!log.write_chrome_trace(trace_file))
+      fprintf(stderr, "Could not write %s\n", trace_file);
+  }
+
+  upcxx::barrier();
+  upcxx::finalize();
+  return 0;
+}
@@ -0,0 +1,436 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bcast_signal.hpp"
+#include "put_window.hpp"
+#include "segment_arena.hpp"
+#include "tree.hpp"
+
+template <typename T>
+struct bcast_request;
+
+// Part of a buffer that a broadcast carries, in elements: `rows` runs of
+// `cols` elements, `ld` apart, from `offset` (a contiguous block is one
+// row), or, if `runs` is non-empty, those (offset, count) runs in order.
+struct bcast_region {
+  size_t offset = 0;
+  size_t rows = 1;
+  size_t cols = 0;
+  size_t ld = 0;
+  std::vector<std::pair<size_t, size_t>> runs;
+
+  static bcast_region contiguous(size_t offset, size_t count) {
+    bcast_region r;
+    r.offset = offset;
+    r.cols = count;
+    r.ld = count;
+    return r;
+  }
+
+  static bcast_region strided(size_t offset, size_t rows, size_t cols, size_t ld) {
+    bcast_region r;
+    r.offset = offset;
+    r.rows = rows;
+    r.cols = cols;
+    r.ld = ld;
+    return r;
+  }
+
+  static bcast_region irregular(std::vector<std::pair<size_t, size_t>> runs) {
+    bcast_region r;
+    r.runs = std::move(runs);
+    return r;
+  }
+
+  // The region as a list of runs, however it was described.
+  std::vector<std::pair<size_t, size_t>> as_runs() const {
+    if (!runs.empty())
+      return runs;
+    std::vector<std::pair<size_t, size_t>> result;
+    for (size_t i = 0; i < rows; i++)
+      result.push_back(std::make_pair(offset + i * ld, cols));
+    return result;
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (const auto& run : as_runs())
+      n += run.second;
+    return n;
+  }
+
+  // First element the region touches.
+  size_t begin() const {
+    size_t first = runs.empty() ? offset : SIZE_MAX;
+    for (const auto& run : runs)
+      first = std::min(first, run.first);
+    return first;
+  }
+
+  // The same region moved to start at element 0.
+  bcast_region rebased() const {
+    bcast_region r = *this;
+    size_t first = begin();
+    r.offset -= std::min(first, r.offset);
+    for (auto& run : r.runs)
+      run.first -= first;
+    return r;
+  }
+};
+
+// Put `from` (relative to `src`) into `to` (relative to `dst`): one rput
+// for a contiguous block, rput_strided for a 2-D one and rput_irregular
+// otherwise. Both regions must hold the same number of elements, in the
+// same rows and columns when both are strided.
+template <typename T, typename Cx>
+upcxx::future<> rput_region(const T* src, const bcast_region& from,
+                            upcxx::global_ptr<T> dst, const bcast_region& to, Cx&& cx) {
+  if (from.runs.empty() && to.runs.empty() && from.rows == 1 && to.rows == 1)
+    return upcxx::rput(src + from.offset, dst + to.offset, to.cols, std::forward<Cx>(cx));
+
+  if (from.runs.empty() && to.runs.empty()) {
+    // A contiguous side is packed rows of the strided side's shape.
+    const bcast_region& shape = (to.rows > 1) ? to : from;
+    size_t from_ld = (from.rows > 1) ? from.ld : shape.cols;
+    size_t to_ld = (to.rows > 1) ? to.ld : shape.cols;
+    std::array<std::ptrdiff_t, 2> src_strides = {{(std::ptrdiff_t) sizeof(T), (std::ptrdiff_t) (from_ld * sizeof(T))}};
+    std::array<std::ptrdiff_t, 2> dst_strides = {{(std::ptrdiff_t) sizeof(T), (std::ptrdiff_t) (to_ld * sizeof(T))}};
+    std::array<size_t, 2> extents = {{shape.cols, shape.rows}};
+    return upcxx::rput_strided<2>(src + from.offset, src_strides, dst + to.offset, dst_strides,
+                                  extents, std::forward<Cx>(cx));
+  }
+
+  std::vector<std::pair<const T*, size_t>> src_runs;
+  for (const auto& run : from.as_runs())
+    src_runs.push_back(std::make_pair(src + run.first, run.second));
+  std::vector<std::pair<upcxx::global_ptr<T>, size_t>> dst_runs;
+  for (const auto& run : to.as_runs())
+    dst_runs.push_back(std::make_pair(dst + run.first, run.second));
+  return upcxx::rput_irregular(src_runs.begin(), src_runs.end(), dst_runs.begin(), dst_runs.end(),
+                               std::forward<Cx>(cx));
+}
+
+// Asynchronous broadcasts over one shared buffer, among the ranks of a team.
+// Each broadcast is an op with an id, a root and a region of the buffer,
+// and any number of ops may be in flight at once, each down its own tree. Every op id has a flag
+// word per rank holding the generation of the last broadcast on that id to
+// arrive, so ids can be reused without resetting flags. Before an id is
+// posted again, every rank must be done with its previous region (e.g.
+// after a barrier).
+template <typename T>
+struct async_broadcast {
+  struct peer {
+    // Global pointer to the data buffer.
+    upcxx::global_ptr<T> data;
+    // Global pointer to the per-op confirmation flags.
+    upcxx::global_ptr<uint64_t> flags;
+  };
+
+  // State of one posted broadcast on this rank.
+  struct op {
+    size_t id, root;
+    bcast_region region;
+    // Value the op's flag reaches once its data is here.
+    uint64_t generation;
+    // Root's zero-copy source, or null to send from my_data(), and the
+    // layout of the data relative to it.
+    const T* source = nullptr;
+    bcast_region source_region;
+    // This rank's children in `tree`, by round, the next round to issue
+    // and the next child in it.
+    std::vector<std::vector<size_t>> rounds;
+    size_t next_round = 0;
+    size_t next_child = 0;
+    // Fulfilled once this rank's data has arrived.
+    upcxx::promise<> arrived;
+    // Every forwarding put issued so far; ready once they have completed.
+    upcxx::future<> forwarded = upcxx::make_future();
+    // Fulfilled once the data is here and all forwarding puts completed.
+    upcxx::promise<> completed;
+    bool arrived_seen = false;
+    bool issued = false;
+    bool finished = false;
+  };
+
+  // `n` elements of buffer, shared by up to `max_ops` op ids. A non-null
+  // `buffer` (local, at least `n` elements) receives the data instead of
+  // a buffer allocated here. Roots and ranks are those of `team`, and
+  // every member constructs its async_broadcast together.
+  async_broadcast(size_t n, size_t max_ops = 1, upcxx::global_ptr<T> buffer = nullptr,
+                  upcxx::team& team = upcxx::world())
+    : bcast_size(n), tm(&team), user_buffer(buffer), generations(max_ops, 0), staged(max_ops),
+      mine(allocate(max_ops), team) {
+    tree.shape = tree_shape::binary_split;
+    peers.emplace(tm->rank_me(), *mine);
+  }
+
+  // Collective: no rank may still be putting to this one.
+  ~async_broadcast() {
+    if (!upcxx::initialized())
+      return;
+    segment_arena& arena = collective_arena();
+    if (!user_buffer)
+      arena.deallocate(mine->data, bcast_size);
+    arena.deallocate(mine->flags, generations.size());
+  }
+
+  // This rank's buffers from collective_arena(), fully built before they
+  // are published.
+  peer allocate(size_t max_ops) {
+    segment_arena& arena = collective_arena();
+    peer p;
+    p.data = user_buffer ? user_buffer : arena.allocate<T>(bcast_size);
+    p.flags = arena.allocate_filled<uint64_t>(max_ops, 0);
+    return p;
+  }
+
+  // Pointers of team rank `r`, fetched from its dist_object on first use
+  // instead of exchanging every rank's pointers during setup.
+  const peer& resolve(size_t r) {
+    auto it = peers.find(r);
+    if (it == peers.end())
+      it = peers.emplace(r, mine.fetch(r).wait()).first;
+    return it->second;
+  }
+
+  // Post broadcast `id` of `count` elements at `offset` (by default the
+  // whole buffer) from `root`, which must have staged its data with
+  // init_root. Every rank posts the same ops, with `id` < max_ops. Posting
+  // an id again first waits for its previous broadcast to complete here.
+  bcast_request<T> ibcast(size_t root, size_t id = 0, size_t offset = 0, size_t count = SIZE_MAX) {
+    return ibcast(root, id, bcast_region::contiguous(offset, std::min(count, bcast_size - offset)));
+  }
+
+  // Post broadcast `id` of a strided or irregular `region` of the buffer.
+  bcast_request<T> ibcast(size_t root, size_t id, const bcast_region& region) {
+    assert(id < generations.size());
+    // This rank may still owe the previous broadcast on `id` to its
+    // children, so that one has to finish before its op is replaced.
+    auto previous = ops.find(id);
+    if (previous != ops.end())
+      bcast_request<T>{this, previous->second}.wait();
+    std::shared_ptr<op> o = std::make_shared<op>();
+    o->id = id;
+    o->root = root;
+    o->region = region;
+    o->generation = ++generations[id];
+    o->source = staged[id].data;
+    o->source_region = staged[id].has_layout ? staged[id].layout : region.rebased();
+    staged[id] = staged_source();
+    o->rounds = tree.rounds(root, tm->rank_me(), tm->rank_n());
+    ops[id] = o;
+    bcast_request<T> request{this, o};
+    advance(*o);
+    return request;
+  }
+
+  // Allgatherv as P overlapping broadcasts: op r, rooted at rank r, carries
+  // counts[r] elements placed after those of ranks 0 .. r-1. This rank's
+  // block is copied in from `block`. Needs max_ops >= rank_n().
+  std::vector<bcast_request<T>> iallgatherv(const T* block, const std::vector<size_t>& counts) {
+    assert(counts.size() == (size_t) tm->rank_n() && counts.size() <= generations.size());
+    size_t me = tm->rank_me();
+    std::vector<size_t> offsets(counts.size() + 1, 0);
+    for (size_t r = 0; r < counts.size(); r++)
+      offsets[r + 1] = offsets[r] + counts[r];
+    std::copy(block, block + counts[me], my_data() + offsets[me]);
+    local_flags()[me] = generations[me] + 1;
+
+    std::vector<bcast_request<T>> requests;
+    for (size_t r = 0; r < counts.size(); r++)
+      requests.push_back(ibcast(r, r, offsets[r], counts[r]));
+    return requests;
+  }
+
+  std::vector<bcast_request<T>> iallgather(const T* block, size_t count) {
+    return iallgatherv(block, std::vector<size_t>(tm->rank_n(), count));
+  }
+
+  // Advance this rank's part of `o`: forward to whatever children are due
+  // and note the data's arrival. Returns true once the data is here and
+  // every forwarding put has completed.
+  bool advance(op& o) {
+    if (o.finished)
+      return true;
+    if (!o.issued && get(o))
+      o.issued = true;
+    if (!o.arrived_seen && check_ready(o)) {
+      o.arrived_seen = true;
+      o.arrived.fulfill_anonymous(1);
+    }
+    upcxx::progress();
+    if (o.arrived_seen && o.issued && o.forwarded.ready()) {
+      o.finished = true;
+      o.completed.fulfill_anonymous(1);
+    }
+    return o.finished;
+  }
+
+  // Advance every op in flight. Ranks wait on ops in different orders, so
+  // polling only the one waited on could starve another rank's op.
+  void progress() {
+    for (auto& entry : ops)
+      advance(*entry.second);
+  }
+
+  // The flag is set locally by the RPC riding on the incoming payload, so
+  // polling is a local load plus progress() to run that RPC.
+  bool check_ready(const op& o) {
+    upcxx::progress();
+    return local_flags()[o.id] >= o.generation;
+  }
+
+  // Issue the next round of puts to this rank's children in `tree` once
+  // the data is here; a radix-k round has up to k-1 puts in flight at
+  // once. Puts that do not fit in `window` wait for a later call rather
+  // than block. Returns true once every round has been issued.
+  bool get(op& o) {
+    if (o.next_round == o.rounds.size())
+      return true;
+    if (!check_ready(o))
+      return false;
+
+    const T* src = (o.source ? o.source : my_data());
+    const bcast_region& from = (o.source ? o.source_region : o.region);
+    const std::vector<size_t>& round = o.rounds[o.next_round];
+    size_t bytes = o.region.size() * sizeof(T);
+    for (; o.next_child < round.size(); o.next_child++) {
+      if (!window.try_acquire(bytes))
+        return false;
+      const peer& p = resolve(round[o.next_child]);
+      upcxx::future<> put = fused_signal::put([&](auto&& cx) {
+          return rput_region(src, from, p.data, o.region, std::forward<decltype(cx)>(cx));
+        }, p.flags + o.id, 1, o.generation);
+      o.forwarded = upcxx::when_all(o.forwarded, window.track(put, bytes));
+    }
+    o.next_round++;
+    o.next_child = 0;
+    return o.next_round == o.rounds.size();
+  }
+
+  // Stage `data` at `offset` for the next broadcast on op `id`, rooted here.
+  void init_root(const std::vector<T>& data, size_t id = 0, size_t offset = 0){
+      assert(id < generations.size());
+      upcxx::rput(data.data(), mine->data + offset, data.size()).wait();
+      local_flags()[id] = generations[id] + 1;
+  }
+
+  // Zero-copy: the next broadcast on op `id` sends straight out of `data`
+  // (local, as many elements as the op), which must stay unchanged until
+  // its puts complete.
+  void init_root(upcxx::global_ptr<T> data, size_t id = 0){
+      assert(id < generations.size());
+      staged[id].data = data.local();
+      local_flags()[id] = generations[id] + 1;
+  }
+
+  // Zero-copy with the data at `layout` relative to `data`, e.g. a panel
+  // of a matrix with a different leading dimension than the op's region.
+  void init_root(upcxx::global_ptr<T> data, size_t id, const bcast_region& layout){
+      init_root(data, id);
+      staged[id].has_layout = true;
+      staged[id].layout = layout;
+  }
+
+  volatile uint64_t* local_flags() {
+    return mine->flags.local();
+  }
+
+  T* my_data() {
+    return mine->data.local();
+  }
+
+  size_t bcast_size;
+  // Team the broadcasts run over.
+  upcxx::team* tm;
+  // Caller's receive buffer, or null.
+  upcxx::global_ptr<T> user_buffer;
+  // Shape of the forwarding trees; set before posting.
+  bcast_tree tree;
+  // Bounds this rank's forwarding puts in flight, across all ops.
+  put_window window;
+  // Number of broadcasts posted so far on each op id.
+  std::vector<uint64_t> generations;
+  // Zero-copy source staged for the next broadcast on an op id. Without a
+  // layout of its own, the source is laid out like the op's region.
+  struct staged_source {
+    const T* data = nullptr;
+    bool has_layout = false;
+    bcast_region layout;
+  };
+  std::vector<staged_source> staged;
+  // Latest op posted on each id, shared with the requests for it.
+  std::unordered_map<size_t, std::shared_ptr<op>> ops;
+  // This rank's pointers, published for lazy lookup by the others.
+  upcxx::dist_object<peer> mine;
+  // Pointers of the ranks this process has talked to.
+  std::unordered_map<size_t, peer> peers;
+};
+
+// Handle to a broadcast posted with ibcast(). Polling it with test() or
+// one of the waits advances this rank's forwarding of every op in flight;
+// data() and done() become ready, and their then() continuations run, from
+// within those polls.
+template <typename T>
+struct bcast_request {
+  async_broadcast<T>* bcast;
+  std::shared_ptr<typename async_broadcast<T>::op> o;
+
+  // True once the data is here and all forwarding puts have completed.
+  bool test() {
+    bcast->progress();
+    return o->finished;
+  }
+
+  void wait() {
+    while (!test()) {
+    }
+  }
+
+  void wait_data() {
+    while (!data().ready()) {
+      test();
+    }
+  }
+
+  // Wait until every forwarding put has been issued (not completed).
+  void wait_issue() {
+    while (!o->issued) {
+      test();
+    }
+  }
+
+  upcxx::future<> data() const {
+    return o->arrived.get_future();
+  }
+
+  upcxx::future<> done() const {
+    return o->completed.get_future();
+  }
+
+  template <typename Func>
+  auto then(Func func) const {
+    return done().then(func);
+  }
+};
+
+// Poll all of `requests` until every one of them is complete.
+template <typename T>
+void wait_all(std::vector<bcast_request<T>>& requests) {
+  bool done = false;
+  while (!done) {
+    done = true;
+    for (auto& request : requests)
+      done = request.test() && done;
+  }
+}
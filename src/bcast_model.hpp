@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include <upcxx/upcxx.hpp>
+
+#include "broadcast_data.hpp"
+
+// Algorithm, segment size (in elements) and, for the k-nomial tree, radix
+// chosen for one broadcast size.
+struct bcast_plan {
+  bcast_algorithm algorithm;
+  size_t segment_size;
+  size_t radix;
+};
+
+// Alpha-beta (Hockney) cost model: one network operation of m bytes costs
+// alpha + beta*m. Every hop of our broadcasts is a single put, with the
+// receiver's flags set by an RPC riding on it. The sender must first read
+// the receiver's open word, but forwarders issue those reads while their
+// own data is still on the way, so only the root's read, one more alpha,
+// is on the critical path.
+struct bcast_model {
+  double alpha = 2e-6;
+  double beta = 1e-10;
+
+  // Smallest segment the pipelined broadcast will use, in bytes.
+  static constexpr size_t min_segment_bytes = 8192;
+  // Largest k-nomial radix considered.
+  static constexpr size_t max_radix = 16;
+  // Crossover to the bulk path: the LL protocol is only considered for
+  // broadcasts of at most this many bytes (and within ll_buffer_limit).
+  size_t ll_crossover = 4096;
+
+  double hop(double bytes) const {
+    return alpha + beta * bytes;
+  }
+
+  // Depth of the binomial MST.
+  static double tree_depth(size_t p) {
+    return std::ceil(std::log2((double) p));
+  }
+
+  // Depth of the binary tree the pipelined broadcast uses.
+  static double pipeline_depth(size_t p) {
+    return std::floor(std::log2((double) p));
+  }
+
+  // Segment size (bytes) minimizing (n/s + D - 1) * 2 * hop(s): every
+  // rank sends each segment to up to two children.
+  double best_segment(double bytes, size_t p) const {
+    double depth = pipeline_depth(p);
+    if (depth <= 1)
+      return bytes;
+    double s = std::sqrt(alpha * bytes / (beta * (depth - 1)));
+    return std::min(bytes, std::max(s, (double) min_segment_bytes));
+  }
+
+  // k-nomial tree: ceil(log_k p) rounds of k-1 concurrent puts, whose
+  // startups overlap but which share the sender's bandwidth.
+  double knomial_time(double bytes, size_t p, size_t k) const {
+    double rounds = std::ceil(std::log((double) p) / std::log((double) k) - 1e-9);
+    return rounds * (alpha + (k - 1) * beta * bytes);
+  }
+
+  // Radix minimizing knomial_time: wide trees for small messages, where
+  // latency dominates, down to binary ones for large messages.
+  size_t best_radix(double bytes, size_t p) const {
+    size_t best = 2;
+    for (size_t k = 3; k <= std::min(max_radix, std::max<size_t>(p, 2)); k++) {
+      if (knomial_time(bytes, p, k) < knomial_time(bytes, p, best))
+        best = k;
+    }
+    return best;
+  }
+
+  // `ppn` is the number of ranks per node (local_team size).
+  double estimate(bcast_algorithm alg, double bytes, size_t p, size_t ppn = 1) const {
+    if (p <= 1)
+      return 0;
+    double depth = tree_depth(p);
+    // The root's read of its first receiver's open word.
+    double open_read = alpha;
+    switch (alg) {
+      case bcast_algorithm::flat:
+        return open_read + (p - 1) * hop(bytes);
+      case bcast_algorithm::mst:
+        return open_read + depth * hop(bytes);
+      case bcast_algorithm::pipelined: {
+        double s = best_segment(bytes, p);
+        double fanout = (p > 2) ? 2 : 1;
+        return open_read + (std::ceil(bytes / s) + pipeline_depth(p) - 1) * fanout * hop(s);
+      }
+      case bcast_algorithm::scatter_allgather:
+        return open_read + depth * alpha + beta * bytes * (p - 1) / p
+               + (p - 1) * hop(bytes / p);
+      case bcast_algorithm::hierarchical: {
+        // MST among nodes, then one shared-memory copy, charged as a put.
+        if (ppn <= 1)
+          return open_read + depth * hop(bytes) + hop(bytes);
+        size_t nodes = (p + ppn - 1) / ppn;
+        return open_read + tree_depth(nodes) * hop(bytes) + hop(bytes);
+      }
+      case bcast_algorithm::tree:
+        return open_read + knomial_time(bytes, p, best_radix(bytes, p));
+      case bcast_algorithm::ll:
+        // One put per hop, with the flags doubling the payload. A receive
+        // line only needs the previous epoch opened, which the last
+        // broadcast's read has usually already seen, so there is no read.
+        return depth * (alpha + 2 * beta * bytes);
+      case bcast_algorithm::pull:
+        // Per level: a flag probe, the rget and the flag read validating it.
+        return depth * (3 * alpha + beta * bytes);
+    }
+    return 0;
+  }
+
+  // Cheapest algorithm for `n` elements of `elem_size` bytes over `p` ranks.
+  // Ties go to the simpler algorithm, so tiny P ends up with flat puts.
+  bcast_plan choose(size_t n, size_t elem_size, size_t p, size_t ppn = 1) const {
+    const bcast_algorithm algs[] = {bcast_algorithm::flat, bcast_algorithm::mst,
+                                    bcast_algorithm::pipelined,
+                                    bcast_algorithm::scatter_allgather,
+                                    bcast_algorithm::hierarchical,
+                                    bcast_algorithm::tree};
+    double bytes = (double) n * elem_size;
+    bcast_plan plan = {bcast_algorithm::flat, 0, 2};
+    double best = estimate(bcast_algorithm::flat, bytes, p, ppn);
+    if (bytes <= std::min<double>(ll_crossover, ll_buffer_limit)
+        && estimate(bcast_algorithm::ll, bytes, p, ppn) < best) {
+      best = estimate(bcast_algorithm::ll, bytes, p, ppn);
+      plan.algorithm = bcast_algorithm::ll;
+    }
+    for (bcast_algorithm alg : algs) {
+      double t = estimate(alg, bytes, p, ppn);
+      if (t < best) {
+        best = t;
+        plan.algorithm = alg;
+      }
+    }
+    plan.segment_size = segment_size(plan.algorithm, n, elem_size, p);
+    if (plan.algorithm == bcast_algorithm::tree)
+      plan.radix = best_radix(bytes, p);
+    return plan;
+  }
+
+  // Segment size (in elements) `alg` should use for `n` elements; 0 means
+  // a single segment.
+  size_t segment_size(bcast_algorithm alg, size_t n, size_t elem_size, size_t p) const {
+    if (alg == bcast_algorithm::pipelined)
+      return std::max<size_t>(1, best_segment((double) n * elem_size, p) / elem_size);
+    if (alg == bcast_algorithm::scatter_allgather)
+      return (n + p - 1) / p;
+    return 0;
+  }
+
+  template <typename T>
+  bcast_plan choose(size_t n) const {
+    return choose(n, sizeof(T), upcxx::rank_n(), upcxx::local_team().rank_n());
+  }
+
+  bool save(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (f == nullptr)
+      return false;
+    fprintf(f, "%.12e %.12e\n", alpha, beta);
+    fclose(f);
+    return true;
+  }
+
+  bool load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == nullptr)
+      return false;
+    bool ok = fscanf(f, "%lf %lf", &alpha, &beta) == 2;
+    fclose(f);
+    return ok;
+  }
+
+  // Collective. Rank 0 loads the model from `path` and shares it; returns
+  // false on every rank if the file could not be read.
+  bool load_all(const char* path) {
+    int ok = 0;
+    if (upcxx::rank_me() == 0)
+      ok = load(path);
+    ok = upcxx::broadcast(ok, 0).wait();
+    if (ok)
+      share();
+    return ok;
+  }
+
+  // Collective. Measures alpha and beta with blocking puts from rank 0 to
+  // the last rank, which is the most likely one to sit on another node.
+  static bcast_model calibrate(int reps = 20, size_t large_bytes = 1 << 20) {
+    bcast_model model;
+    size_t peer = upcxx::rank_n() - 1;
+    if (peer == 0)
+      return model;
+
+    upcxx::global_ptr<char> buf = nullptr;
+    if (upcxx::rank_me() == peer)
+      buf = upcxx::new_array<char>(large_bytes);
+    buf = upcxx::broadcast(buf, peer).wait();
+
+    if (upcxx::rank_me() == 0) {
+      std::vector<char> src(large_bytes, 1);
+      double small = time_puts(src.data(), buf, 8, reps);
+      double large = time_puts(src.data(), buf, large_bytes, reps);
+      model.alpha = small;
+      model.beta = std::max(large - small, 0.0) / large_bytes;
+    }
+    model.share();
+    upcxx::barrier();
+    if (upcxx::rank_me() == peer)
+      upcxx::delete_array(buf);
+    return model;
+  }
+
+  // Average time of one blocking put of `bytes`, after one warm-up put.
+  static double time_puts(const char* src, upcxx::global_ptr<char> dst,
+                          size_t bytes, int reps) {
+    upcxx::rput(src, dst, bytes).wait();
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < reps; i++)
+      upcxx::rput(src, dst, bytes).wait();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - begin).count() / reps;
+  }
+
+  // Collective. Copies rank 0's parameters to every rank.
+  void share() {
+    alpha = upcxx::broadcast(alpha, 0).wait();
+    beta = upcxx::broadcast(beta, 0).wait();
+  }
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+// Signal policies: how a broadcast's put tells its receiver the data is
+// there. put(issue, flags, n_flags, value) calls issue(cx) to start the
+// payload put (a block or a region) with completions `cx`, and has the
+// `n_flags` flags at `flags` set to `value` at the target once the payload
+// has landed. The future it returns is ready once both are done.
+
+// The flags are set by an RPC riding on the payload's remote completion, so
+// one network operation both delivers and signals.
+struct fused_signal {
+  template <typename Issue>
+  static upcxx::future<> put(Issue&& issue, upcxx::global_ptr<uint64_t> flags, size_t n_flags,
+                             uint64_t value) {
+    return issue(upcxx::operation_cx::as_future() |
+      upcxx::remote_cx::as_rpc([](upcxx::global_ptr<uint64_t> flags, size_t n_flags, uint64_t value){
+          std::fill(flags.local(), flags.local() + n_flags, value);
+        }, flags, n_flags, value));
+  }
+};
+
+// The flags follow in a second put once the payload has completed. Their
+// values are a temporary, so that put is buffered at injection.
+struct put_signal {
+  template <typename Issue>
+  static upcxx::future<> put(Issue&& issue, upcxx::global_ptr<uint64_t> flags, size_t n_flags,
+                             uint64_t value) {
+    return issue(upcxx::operation_cx::as_future()).then([=](){
+        std::vector<uint64_t> values(n_flags, value);
+        return upcxx::rput(values.data(), flags, n_flags,
+                           upcxx::source_cx::as_buffered() | upcxx::operation_cx::as_future());
+      });
+  }
+};
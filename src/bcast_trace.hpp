@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+// Tracing policies for broadcast_data's Trace parameter.
+//
+// no_trace, the default, has nothing but empty inline hooks, so an
+// untraced broadcast compiles to what it was without them. hop_trace
+// records, on each rank, one hop_record per put it sends and one
+// arrival_record per broadcast it takes part in. gather_trace() merges
+// them on one rank into a trace_log, which writes a Chrome/Perfetto trace
+// and prints the critical path.
+//
+// Times are seconds since the rank's clock origin, set by start() right
+// after a barrier, so clocks agree to within the barrier's skew.
+
+// One put of a broadcast: `parent` sent `bytes` to `child`. `begin` is
+// when the put was asked for, `issue` when it was injected (after waiting
+// for the child to open the epoch and for room in the sender's put
+// window) and `complete` when the parent saw it complete, which for an
+// RDMA put means the data is at the child.
+struct hop_record {
+  uint64_t epoch;
+  int32_t parent, child;
+  uint64_t bytes;
+  double begin, issue, complete;
+};
+
+// One rank's view of broadcast `epoch`: when it opened the epoch, first
+// polled for data that was not there yet (0: never) and saw the data.
+struct arrival_record {
+  uint64_t epoch;
+  int32_t rank;
+  double open, first_poll, observed;
+};
+
+struct no_trace {
+  static constexpr bool enabled = false;
+  void opened(uint64_t) {}
+  size_t put_begin(uint64_t, size_t, size_t) { return 0; }
+  size_t get_begin(uint64_t, size_t, size_t) { return 0; }
+  void put_issued(size_t) {}
+  void put_completed(size_t) {}
+  void waiting(uint64_t) {}
+  void arrived(uint64_t) {}
+};
+
+struct hop_trace {
+  static constexpr bool enabled = true;
+
+  hop_trace() : origin(std::chrono::steady_clock::now()) {}
+
+  // Collective: line the ranks' clocks up and drop earlier records.
+  void start() {
+    upcxx::barrier();
+    origin = std::chrono::steady_clock::now();
+    hops.clear();
+    arrivals.clear();
+  }
+
+  double now() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+  }
+
+  void opened(uint64_t epoch) {
+    arrivals.push_back(arrival_record{epoch, (int32_t) upcxx::rank_me(), now(), 0, 0});
+  }
+
+  size_t put_begin(uint64_t epoch, size_t dest, size_t bytes) {
+    double t = now();
+    hops.push_back(hop_record{epoch, (int32_t) upcxx::rank_me(), (int32_t) dest, bytes, t, t, 0});
+    return hops.size() - 1;
+  }
+
+  // An rget by this rank from `src`, recorded as a hop from it; it is
+  // issued at once.
+  size_t get_begin(uint64_t epoch, size_t src, size_t bytes) {
+    double t = now();
+    hops.push_back(hop_record{epoch, (int32_t) src, (int32_t) upcxx::rank_me(), bytes, t, t, 0});
+    return hops.size() - 1;
+  }
+
+  void put_issued(size_t id) {
+    hops[id].issue = now();
+  }
+
+  void put_completed(size_t id) {
+    hops[id].complete = now();
+  }
+
+  // Polled for broadcast `epoch` and found its data missing.
+  void waiting(uint64_t epoch) {
+    arrival_record* a = current(epoch);
+    if (a && a->first_poll == 0 && a->observed == 0)
+      a->first_poll = now();
+  }
+
+  void arrived(uint64_t epoch) {
+    arrival_record* a = current(epoch);
+    if (a && a->observed == 0)
+      a->observed = now();
+  }
+
+  arrival_record* current(uint64_t epoch) {
+    if (arrivals.empty() || arrivals.back().epoch != epoch)
+      return nullptr;
+    return &arrivals.back();
+  }
+
+  std::chrono::steady_clock::time_point origin;
+  std::vector<hop_record> hops;
+  std::vector<arrival_record> arrivals;
+};
+
+// Records of all ranks, merged.
+struct trace_log {
+  std::vector<hop_record> hops;
+  std::vector<arrival_record> arrivals;
+
+  const arrival_record* arrival(uint64_t epoch, int32_t rank) const {
+    for (const arrival_record& a : arrivals) {
+      if (a.epoch == epoch && a.rank == rank)
+        return &a;
+    }
+    return nullptr;
+  }
+
+  // The hop that delivered the last of `child`'s data for `epoch`.
+  const hop_record* last_hop_to(uint64_t epoch, int32_t child) const {
+    const hop_record* last = nullptr;
+    for (const hop_record& h : hops) {
+      if (h.epoch == epoch && h.child == child && (!last || h.complete > last->complete))
+        last = &h;
+    }
+    return last;
+  }
+
+  // Chrome trace format: one process per rank, sends on thread 0 and
+  // waiting for data on thread 1, with a flow arrow from each put to the
+  // child seeing its data. Times are in microseconds.
+  bool write_chrome_trace(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (!f)
+      return false;
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    const char* sep = "";
+    std::map<int32_t, bool> ranks;
+    for (const arrival_record& a : arrivals)
+      ranks[a.rank] = true;
+    for (const auto& r : ranks) {
+      fprintf(f, "%s{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}",
+              sep, r.first, r.first);
+      sep = ",\n";
+      fprintf(f, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"puts\"}}",
+              sep, r.first);
+      fprintf(f, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": 1, \"args\": {\"name\": \"data\"}}",
+              sep, r.first);
+    }
+    size_t flow = 0;
+    for (const hop_record& h : hops) {
+      if (h.issue > h.begin) {
+        fprintf(f, "%s{\"ph\": \"X\", \"name\": \"wait for %d\", \"pid\": %d, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}",
+                sep, h.child, h.parent, h.begin * 1e6, (h.issue - h.begin) * 1e6);
+      }
+      fprintf(f, "%s{\"ph\": \"X\", \"name\": \"put to %d\", \"pid\": %d, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, "
+                 "\"args\": {\"epoch\": %llu, \"bytes\": %llu}}",
+              sep, h.child, h.parent, h.issue * 1e6, (h.complete - h.issue) * 1e6,
+              (unsigned long long) h.epoch, (unsigned long long) h.bytes);
+      const arrival_record* a = arrival(h.epoch, h.child);
+      if (a && a->observed > 0) {
+        fprintf(f, "%s{\"ph\": \"s\", \"name\": \"hop\", \"cat\": \"hop\", \"id\": %zu, \"pid\": %d, \"tid\": 0, \"ts\": %.3f}",
+                sep, flow, h.parent, h.issue * 1e6);
+        fprintf(f, "%s{\"ph\": \"f\", \"bp\": \"e\", \"name\": \"hop\", \"cat\": \"hop\", \"id\": %zu, \"pid\": %d, \"tid\": 1, \"ts\": %.3f}",
+                sep, flow, h.child, a->observed * 1e6);
+        flow++;
+      }
+    }
+    for (const arrival_record& a : arrivals) {
+      if (a.first_poll > 0) {
+        fprintf(f, "%s{\"ph\": \"X\", \"name\": \"poll\", \"pid\": %d, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f, "
+                   "\"args\": {\"epoch\": %llu}}",
+                sep, a.rank, a.first_poll * 1e6, (a.observed - a.first_poll) * 1e6,
+                (unsigned long long) a.epoch);
+      }
+      if (a.observed > 0) {
+        fprintf(f, "%s{\"ph\": \"i\", \"s\": \"t\", \"name\": \"data %llu\", \"pid\": %d, \"tid\": 1, \"ts\": %.3f}",
+                sep, (unsigned long long) a.epoch, a.rank, a.observed * 1e6);
+      }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+  }
+
+  // For every broadcast, walk back from the last rank to see its data to
+  // the root, splitting each hop into the time the parent held the data
+  // before asking for the put, waited for the child to open the epoch,
+  // and the put itself took until the child saw it. Then the mean
+  // transfer time per tree depth and the ranks that were last most often.
+  void print_critical_path() const {
+    std::map<uint64_t, bool> epochs;
+    for (const arrival_record& a : arrivals)
+      epochs[a.epoch] = true;
+    std::map<size_t, std::pair<double, size_t>> depth_transfer;
+    std::map<int32_t, size_t> last_counts;
+
+    for (const auto& e : epochs) {
+      uint64_t epoch = e.first;
+      const arrival_record* last = nullptr;
+      for (const arrival_record& a : arrivals) {
+        if (a.epoch == epoch && (!last || a.observed > last->observed))
+          last = &a;
+      }
+      if (!last)
+        continue;
+      last_counts[last->rank]++;
+
+      std::vector<const hop_record*> path;
+      int32_t r = last->rank;
+      const hop_record* h;
+      while ((h = last_hop_to(epoch, r)) != nullptr && path.size() < arrivals.size()) {
+        path.push_back(h);
+        r = h->parent;
+      }
+      std::reverse(path.begin(), path.end());
+      const arrival_record* root = arrival(epoch, r);
+      double start = root ? root->open : 0;
+
+      printf("Broadcast %llu: rank %d last after %.3f us, path %d",
+             (unsigned long long) epoch, last->rank, (last->observed - start) * 1e6, r);
+      for (const hop_record* p : path)
+        printf(" -> %d", p->child);
+      printf("\n");
+      for (size_t d = 0; d < path.size(); d++) {
+        const hop_record* p = path[d];
+        const arrival_record* from = arrival(epoch, p->parent);
+        const arrival_record* to = arrival(epoch, p->child);
+        double held = from ? p->begin - std::max(from->open, from->observed) : 0;
+        double transfer = to ? to->observed - p->issue : p->complete - p->issue;
+        printf("  %d -> %d \t held %.3f us \t receiver wait %.3f us \t transfer %.3f us \t %llu bytes\n",
+               p->parent, p->child, std::max(0.0, held) * 1e6, (p->issue - p->begin) * 1e6,
+               transfer * 1e6, (unsigned long long) p->bytes);
+      }
+    }
+
+    // Depth of every hop's child, from the hops into each rank.
+    for (const auto& e : epochs) {
+      std::map<int32_t, size_t> depth;
+      bool grew = true;
+      while (grew) {
+        grew = false;
+        for (const hop_record& h : hops) {
+          if (h.epoch != e.first || depth.count(h.child))
+            continue;
+          if (last_hop_to(h.epoch, h.parent) == nullptr)
+            depth[h.parent] = 0;
+          auto it = depth.find(h.parent);
+          if (it == depth.end())
+            continue;
+          depth[h.child] = it->second + 1;
+          grew = true;
+          const arrival_record* to = arrival(h.epoch, h.child);
+          double transfer = to ? to->observed - h.issue : h.complete - h.issue;
+          auto& acc = depth_transfer[it->second + 1];
+          acc.first += transfer;
+          acc.second++;
+        }
+      }
+    }
+    for (const auto& d : depth_transfer) {
+      printf("Depth %zu: \t %zu hops \t mean transfer %.3f us\n", d.first, d.second.second,
+             d.second.first / d.second.second * 1e6);
+    }
+    for (const auto& l : last_counts)
+      printf("Rank %d was last in %zu of %zu broadcasts\n", l.first, l.second, epochs.size());
+  }
+};
+
+// Collective: merge every rank's records on `root`; the others get an
+// empty log.
+inline trace_log gather_trace(const hop_trace& trace, int root = 0) {
+  upcxx::dist_object<std::pair<std::vector<hop_record>, std::vector<arrival_record>>> records(
+    std::make_pair(trace.hops, trace.arrivals));
+  trace_log log;
+  if (upcxx::rank_me() == root) {
+    for (int r = 0; r < upcxx::rank_n(); r++) {
+      auto theirs = records.fetch(r).wait();
+      log.hops.insert(log.hops.end(), theirs.first.begin(), theirs.first.end());
+      log.arrivals.insert(log.arrivals.end(), theirs.second.begin(), theirs.second.end());
+    }
+  }
+  // Nobody's records may go away while the root is still fetching them.
+  upcxx::barrier();
+  return log;
+}
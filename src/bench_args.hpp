@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+
+// Command-line options shared by the benchmark programs: `-name value`
+// pairs, or a bare `-name` for a switch.
+
+inline int find_arg_idx(int argc, char** argv, const char* option) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], option) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// True if the switch `option` is present.
+inline bool find_int_arg(int argc, char** argv, const char* option, bool default_value) {
+    int iplace = find_arg_idx(argc, argv, option);
+
+    if (iplace >= 0 && iplace < argc) {
+        return true;
+    }
+
+    return default_value;
+}
+
+inline size_t find_size_arg(int argc, char** argv, const char* option, size_t default_value) {
+    int iplace = find_arg_idx(argc, argv, option);
+
+    if (iplace >= 0 && iplace < argc - 1) {
+        return std::stoull(argv[iplace + 1]);
+    }
+
+    return default_value;
+}
+
+inline char* find_string_arg(int argc, char** argv, const char* option, char* default_value) {
+    int iplace = find_arg_idx(argc, argv, option);
+
+    if (iplace >= 0 && iplace < argc - 1) {
+        return argv[iplace + 1];
+    }
+
+    return default_value;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Summary of the repeated timings of one benchmark configuration. Shared by
+// the UPC++ driver (BcastBench) and the MPI one (mpi_baseline/MPI_bench) so
+// their CSV and JSON output can be compared line by line.
+struct bench_result {
+  std::string impl;
+  std::string algorithm;
+  size_t bytes;
+  int ranks;
+  int root;
+  size_t iterations;
+  // Latencies in seconds, each the slowest rank's time for one iteration.
+  double min, median, p99, max;
+  // Bytes per second at the median latency.
+  double bandwidth;
+};
+
+// Nearest-rank percentile of sorted `samples`, `p` in [0, 1].
+inline double percentile(const std::vector<double>& samples, double p) {
+  if (samples.empty())
+    return 0;
+  size_t rank = (size_t) std::ceil(p * samples.size());
+  return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+inline bench_result summarize(const std::string& impl, const std::string& algorithm,
+                              size_t bytes, int ranks, int root,
+                              std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  bench_result r;
+  r.impl = impl;
+  r.algorithm = algorithm;
+  r.bytes = bytes;
+  r.ranks = ranks;
+  r.root = root;
+  r.iterations = samples.size();
+  r.min = percentile(samples, 0);
+  r.median = percentile(samples, 0.5);
+  r.p99 = percentile(samples, 0.99);
+  r.max = samples.empty() ? 0 : samples.back();
+  r.bandwidth = (r.median > 0) ? bytes / r.median : 0;
+  return r;
+}
+
+// Message sizes from `min_bytes` to `max_bytes`, doubling.
+inline std::vector<size_t> bench_sizes(size_t min_bytes, size_t max_bytes) {
+  std::vector<size_t> sizes;
+  for (size_t b = std::max<size_t>(min_bytes, 1); b <= max_bytes; b *= 2)
+    sizes.push_back(b);
+  return sizes;
+}
+
+inline void print_header() {
+  printf("%-6s %-18s %12s %6s %5s %12s %12s %12s %12s %12s\n", "impl", "algorithm",
+         "bytes", "ranks", "root", "min(s)", "median(s)", "p99(s)", "max(s)", "MB/s");
+}
+
+inline void print_result(const bench_result& r) {
+  printf("%-6s %-18s %12zu %6d %5d %12.3e %12.3e %12.3e %12.3e %12.2f\n",
+         r.impl.c_str(), r.algorithm.c_str(), r.bytes, r.ranks, r.root,
+         r.min, r.median, r.p99, r.max, r.bandwidth / 1e6);
+}
+
+// Append `results` to a CSV file, writing the header if the file is new,
+// so runs at different rank counts accumulate in one table.
+inline bool write_csv(const char* path, const std::vector<bench_result>& results) {
+  FILE* f = fopen(path, "r");
+  bool exists = (f != nullptr);
+  if (f)
+    fclose(f);
+  f = fopen(path, "a");
+  if (!f)
+    return false;
+  if (!exists)
+    fprintf(f, "impl,algorithm,bytes,ranks,root,iterations,min,median,p99,max,bandwidth\n");
+  for (const bench_result& r : results) {
+    fprintf(f, "%s,%s,%zu,%d,%d,%zu,%e,%e,%e,%e,%e\n", r.impl.c_str(),
+            r.algorithm.c_str(), r.bytes, r.ranks, r.root, r.iterations,
+            r.min, r.median, r.p99, r.max, r.bandwidth);
+  }
+  fclose(f);
+  return true;
+}
+
+// Write `results` as a JSON array of objects, replacing the file.
+inline bool write_json(const char* path, const std::vector<bench_result>& results) {
+  FILE* f = fopen(path, "w");
+  if (!f)
+    return false;
+  fprintf(f, "[\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const bench_result& r = results[i];
+    fprintf(f, "  {\"impl\": \"%s\", \"algorithm\": \"%s\", \"bytes\": %zu, "
+               "\"ranks\": %d, \"root\": %d, \"iterations\": %zu, \"min\": %e, "
+               "\"median\": %e, \"p99\": %e, \"max\": %e, \"bandwidth\": %e}%s\n",
+            r.impl.c_str(), r.algorithm.c_str(), r.bytes, r.ranks, r.root,
+            r.iterations, r.min, r.median, r.p99, r.max, r.bandwidth,
+            (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(f, "]\n");
+  fclose(f);
+  return true;
+}
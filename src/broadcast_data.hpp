@@ -0,0 +1,1026 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bcast_signal.hpp"
+#include "bcast_trace.hpp"
+#include "put_window.hpp"
+#include "segment_arena.hpp"
+#include "tree.hpp"
+
+enum class bcast_algorithm { flat, mst, pipelined, scatter_allgather, hierarchical, tree, ll, pull };
+
+inline const char* bcast_algorithm_name(bcast_algorithm alg) {
+  switch (alg) {
+    case bcast_algorithm::flat: return "flat";
+    case bcast_algorithm::mst: return "mst";
+    case bcast_algorithm::pipelined: return "pipelined";
+    case bcast_algorithm::scatter_allgather: return "scatter_allgather";
+    case bcast_algorithm::hierarchical: return "hierarchical";
+    case bcast_algorithm::tree: return "tree";
+    case bcast_algorithm::ll: return "ll";
+    case bcast_algorithm::pull: return "pull";
+  }
+  return "unknown";
+}
+
+// Algorithms named in the comma-separated `list`, or all of them.
+inline std::vector<bcast_algorithm> parse_bcast_algorithms(const char* list) {
+  const bcast_algorithm all[] = {bcast_algorithm::flat, bcast_algorithm::mst,
+                                 bcast_algorithm::pipelined,
+                                 bcast_algorithm::scatter_allgather,
+                                 bcast_algorithm::hierarchical,
+                                 bcast_algorithm::tree,
+                                 bcast_algorithm::ll,
+                                 bcast_algorithm::pull};
+  std::vector<bcast_algorithm> algs;
+  std::string names = (list == nullptr) ? "" : std::string(",") + list + ",";
+  for (bcast_algorithm alg : all) {
+    if (list == nullptr || names.find(std::string(",") + bcast_algorithm_name(alg) + ",") != std::string::npos)
+      algs.push_back(alg);
+  }
+  return algs;
+}
+
+// Largest buffer, in bytes, that gets the low-latency (LL) protocol's
+// receive lines; broadcasts of bigger buffers always take the bulk path.
+constexpr size_t ll_buffer_limit = 65536;
+
+// A persistent broadcast handle: buffers and flags are set up once and
+// reused by every broadcast() call, from any root, without a reset.
+// Broadcast number e (the epoch, counted from 1) is complete on a rank once
+// all its segment flags read e. Each rank also keeps an "open" word after
+// its flags holding the last epoch it is prepared to receive, which senders
+// check before overwriting its buffer.
+//
+// Setup exchanges no pointer tables: every rank publishes its own pointers
+// in a dist_object and fetches a peer's only when it first talks to it, so
+// a rank ends up knowing just its tree partners. The only collectives are
+// the split that forms the team of node leaders and a broadcast within
+// each node.
+//
+// With `shared_buffer` the data is treated as read-only and a node holds a
+// single copy: only the node leader allocates the buffer and receives the
+// broadcast, and my_data() on every rank of the node points into it. The
+// segment flags are the leader's too; each rank keeps just its open word,
+// and the leader opens an epoch only once all of its node has.
+//
+// Small buffers can also be broadcast with the LL protocol, where every
+// 8-byte word carries 4 bytes of payload next to the low half of the
+// epoch. One put then both delivers and signals, and a receiver spins on
+// its own memory until every word shows the epoch. Receive lines alternate
+// between two slots by epoch parity, so a sender only needs the receiver
+// to have opened the previous epoch.
+//
+// In a pull broadcast nobody pushes: each rank rgets the buffer from any
+// rank that already holds it (see broadcast_pull), and only once it first
+// polls for the data.
+//
+// `Trace` is a tracing policy from bcast_trace.hpp; with hop_trace every
+// put and every rank's arrival is recorded in `trace`. `SignalPolicy`, from
+// bcast_signal.hpp, sets how every put signals its receiver. `TreePolicy`,
+// from tree.hpp, is the tree of bcast_algorithm::tree, the LL protocol and
+// pull broadcasts: by default a bcast_tree, whose shape is set at run time.
+template <typename T, typename Trace = no_trace, typename SignalPolicy = fused_signal,
+          typename TreePolicy = bcast_tree>
+struct broadcast_data {
+  struct peer {
+    // Global pointer to the data buffer.
+    upcxx::global_ptr<T> data;
+    // Global pointer to the per-segment epoch flags, followed by the open
+    // word: one cache-line-aligned array, so with up to seven segments a
+    // poll touches a single line.
+    upcxx::global_ptr<uint64_t> flags;
+    // Global pointer to the two slots of LL receive lines, or null.
+    upcxx::global_ptr<uint64_t> ll;
+    // Rank of this process's node leader in the `leaders` team.
+    int node = 0;
+    // Last epoch this rank was seen to have opened.
+    uint64_t opened = 0;
+  };
+
+  // This rank's children, by round and in send order, and ancestors in
+  // `tree` for one root; see schedule_for().
+  struct tree_schedule {
+    TreePolicy tree;
+    std::vector<std::vector<size_t>> rounds;
+    std::vector<size_t> children;
+    std::vector<size_t> ancestors;
+  };
+
+  // `seg_size` splits the buffer into segments of that many elements,
+  // each with its own confirmation flag (0 means a single segment).
+  // `shared` selects one node-shared buffer per local_team. A non-null
+  // `buffer` (local, at least `n` elements) receives the data instead of a
+  // buffer allocated here; it stays owned by the caller.
+  broadcast_data(size_t n, size_t seg_size = 0, bool shared = false,
+                 upcxx::global_ptr<T> buffer = nullptr)
+    : bcast_size(n),
+      segment_size((seg_size == 0 || seg_size > n) ? n : seg_size),
+      n_segments((n + segment_size - 1) / segment_size),
+      epoch(0),
+      shared_buffer(shared),
+      user_buffer(buffer),
+      leaders(upcxx::world().split(
+        upcxx::local_team().rank_me() == 0 ? 0 : upcxx::team::color_none,
+        upcxx::rank_me())),
+      mine(allocate()) {
+    peers.emplace(upcxx::rank_me(), *mine);
+  }
+
+  // Collective like the constructor: no rank may still be putting to or
+  // reading from this one, so callers typically barrier first.
+  ~broadcast_data() {
+    if (!upcxx::initialized())
+      return;
+    bool leader = upcxx::local_team().rank_me() == 0;
+    segment_arena& arena = collective_arena();
+    if ((leader || !shared_buffer) && !user_buffer)
+      arena.deallocate(mine->data, bcast_size);
+    arena.deallocate(mine->flags, n_segments + 1);
+    if (mine->ll)
+      arena.deallocate(mine->ll, 2 * ll_lines());
+    if (leader)
+      leaders.destroy();
+  }
+
+  // Allocate this rank's buffers from collective_arena(). Fully built
+  // before it is published, since the node broadcast below lets peers'
+  // fetches run.
+  peer allocate() {
+    bool leader = upcxx::local_team().rank_me() == 0;
+    segment_arena& arena = collective_arena();
+    peer p;
+    if (leader || !shared_buffer)
+      p.data = user_buffer ? user_buffer : arena.allocate<T>(bcast_size);
+    p.flags = arena.allocate_filled<uint64_t>(n_segments + 1, 0);
+    if (!shared_buffer && bcast_size * sizeof(T) <= ll_buffer_limit)
+      p.ll = arena.allocate_filled<uint64_t>(2 * ll_lines(), 0);
+    if (leader)
+      p.node = leaders.rank_me();
+    peer node_peer = upcxx::broadcast(p, 0, upcxx::local_team()).wait();
+    p.node = node_peer.node;
+    node_flags = p.flags;
+    if (shared_buffer) {
+      p.data = node_peer.data;
+      node_flags = node_peer.flags;
+    }
+    return p;
+  }
+
+  // Pointers of rank `r`, fetched on first use.
+  peer& resolve(size_t r) {
+    auto it = peers.find(r);
+    if (it == peers.end())
+      it = peers.emplace(r, mine.fetch(r).wait()).first;
+    return it->second;
+  }
+
+  // Fetch the pointers of all of `ranks` that are not cached yet at once.
+  void resolve(const std::vector<size_t>& ranks) {
+    upcxx::future<> done = upcxx::make_future();
+    for (size_t r : ranks) {
+      if (peers.count(r) == 0) {
+        done = upcxx::when_all(done, mine.fetch(r).then([this, r](peer p){
+            peers.emplace(r, p);
+          }));
+      }
+    }
+    done.wait();
+  }
+
+  upcxx::global_ptr<T> data_ptr(size_t r) {
+    return resolve(r).data;
+  }
+
+  upcxx::global_ptr<uint64_t> flag_ptr(size_t r) {
+    return resolve(r).flags;
+  }
+
+  // Broadcast the root's buffer with `alg`. The buffer must have been
+  // segmented the way the algorithm expects (see bcast_plan). Every rank
+  // calls this once per broadcast, after the root's init_root; the future
+  // tracks this rank's outstanding forwarding puts and must be ready
+  // before the next call.
+  //
+  // With shared_buffer every algorithm runs as the hierarchical one, minus
+  // the on-node copies. Otherwise buffers of at most ll_threshold bytes go
+  // by the LL protocol whatever `alg` is; `ll` itself falls back to `tree`
+  // for buffers without LL lines.
+  upcxx::future<> broadcast(bcast_algorithm alg, size_t root) {
+    open_epoch();
+    if (upcxx::rank_me() == root && source_epoch == epoch)
+      inject_source(alg);
+    if (shared_buffer)
+      return broadcast_hierarchical(root);
+    if (alg == bcast_algorithm::pull)
+      return broadcast_pull(root);
+    if (mine->ll && (alg == bcast_algorithm::ll || bcast_size * sizeof(T) <= ll_threshold))
+      return broadcast_ll(root);
+    switch (alg) {
+      case bcast_algorithm::flat:
+        return broadcast_flat(root);
+      case bcast_algorithm::mst:
+        probe_receivers(bcast_tree::mst_children(root, upcxx::rank_me(), upcxx::rank_n()), epoch);
+        broadcast_MST(root, 0, upcxx::rank_n() - 1);
+        return upcxx::make_future();
+      case bcast_algorithm::pipelined:
+        return broadcast_pipelined(root);
+      case bcast_algorithm::scatter_allgather:
+        return broadcast_scatter_allgather(root);
+      case bcast_algorithm::hierarchical:
+        return broadcast_hierarchical(root);
+      case bcast_algorithm::tree:
+      case bcast_algorithm::ll:
+        return broadcast_tree(root);
+      case bcast_algorithm::pull:
+        return broadcast_pull(root);
+    }
+    return upcxx::make_future();
+  }
+
+  // Root puts its buffer straight to every other process.
+  upcxx::future<> broadcast_flat(size_t root) {
+    upcxx::future<> done = upcxx::make_future();
+    if (upcxx::rank_me() == root) {
+      std::vector<size_t> dests(upcxx::rank_n());
+      for (size_t dest = 0; dest < upcxx::rank_n(); dest++)
+        dests[dest] = dest;
+      resolve(dests);
+      for (size_t dest = 0; dest < upcxx::rank_n(); dest++) {
+        if (dest != root)
+          done = upcxx::when_all(done, put_slices(dest, 0, n_segments - 1));
+      }
+    }
+    return done;
+  }
+
+  // Start the next broadcast on this rank. Once the previous epoch's data
+  // has fully arrived this rank is done with it, so senders may overwrite.
+  void open_epoch() {
+    settle_epoch();
+    release_pull_source();
+    epoch++;
+    trace.opened(epoch);
+    if (shared_buffer && upcxx::local_team().rank_me() == 0)
+      wait_node_opened(epoch);
+    local_flags()[n_segments] = epoch;
+  }
+
+  // Be done with the current epoch's data before this rank's buffer is
+  // reused. A pull whose data this rank never asked for, or has not
+  // started fetching, is dropped: its flags stay behind, so nobody pulls
+  // from it either. Anything else, an rget in flight included, is waited
+  // for, so no late write lands in the buffer afterwards.
+  void settle_epoch() {
+    if (pull_pending() && pulling.state != pull_state::fetching) {
+      pulling.epoch = 0;
+    } else {
+      while (!check_ready()) {
+      }
+    }
+  }
+
+  // Block until every other rank on this node has opened epoch `e`, i.e.
+  // is done reading the node-shared buffer.
+  void wait_node_opened(uint64_t e) {
+    const upcxx::team& local = upcxx::local_team();
+    for (int i = 0; i < local.rank_n(); i++) {
+      if (local[i] == upcxx::rank_me())
+        continue;
+      volatile uint64_t* flags = resolve(local[i]).flags.local();
+      while (flags[n_segments] < e) {
+        upcxx::progress();
+      }
+    }
+  }
+
+  // Ready once `dest` has opened epoch `e`, so a put cannot clobber data it
+  // is still reading or forwarding. Nothing blocks: the open word is read
+  // with an rget, reissued from the next progress() after a read showing
+  // an older epoch (an rget may complete at once, so reissuing it straight
+  // from its own completion would spin), and the read in flight is shared
+  // by every put waiting on it. A
+  // forwarder probes its children as soon as it knows them, so by the time
+  // its data is here the probes have usually cleared and each hop is just
+  // the fused put.
+  upcxx::future<> receiver_opened(size_t dest, uint64_t e) {
+    peer& p = resolve(dest);
+    if (p.opened >= e)
+      return upcxx::make_future();
+    open_probe& probe = open_probes[dest];
+    if (probe.epoch < e) {
+      auto opened = std::make_shared<upcxx::promise<>>();
+      probe.epoch = e;
+      probe.ready = opened->get_future();
+      read_opened(&p, e, opened);
+    }
+    return probe.ready;
+  }
+
+  void read_opened(peer* p, uint64_t e, std::shared_ptr<upcxx::promise<>> opened) {
+    upcxx::rget(p->flags + n_segments).then([this, p, e, opened](uint64_t value){
+        p->opened = std::max(p->opened, value);
+        if (p->opened >= e) {
+          opened->fulfill_anonymous(1);
+          return;
+        }
+        upcxx::current_persona().lpc([](){}).then([this, p, e, opened](){
+            read_opened(p, e, opened);
+          });
+      });
+  }
+
+  // Start the open-word reads for every one of `ranks` at once.
+  void probe_receivers(const std::vector<size_t>& ranks, uint64_t e) {
+    resolve(ranks);
+    for (size_t r : ranks)
+      receiver_opened(r, e);
+  }
+
+  // Broadcast vector `data` from process `root` to
+  // all other processes.
+  void broadcast_MST(size_t root, size_t left, size_t right) { 
+	  if (left == right)
+      return;
+    size_t mid = left + (right - left) / 2;
+    size_t dest = (root <= mid) ? right: left;
+
+    if (upcxx::rank_me() == root){ 
+      while (!check_ready()) { 
+        // incase we send before previous recursion has not finished putting
+      }
+      put_slices(dest, 0, n_segments - 1).wait();
+    }
+
+    if (upcxx::rank_me() <= mid && root <= mid)
+      broadcast_MST(root, left, mid);
+    else if (upcxx::rank_me() <= mid && root > mid)
+      broadcast_MST(dest, left, mid);
+    else if (upcxx::rank_me() > mid && root <= mid)
+      broadcast_MST(dest, mid+1, right);
+    else if  (upcxx::rank_me() > mid && root > mid)
+      broadcast_MST(root, mid+1, right);
+  }
+
+  // Pipelined broadcast: segment k is forwarded to every child as soon
+  // as its flag is set, while segment k+1 is still arriving.
+  // Returns once every segment has been received and all forwarding puts
+  // are issued; the future tracks completion of those puts.
+  upcxx::future<> broadcast_pipelined(size_t root) {
+    std::vector<size_t> children = pipeline_children(root);
+    probe_receivers(children, epoch);
+    upcxx::future<> done = upcxx::make_future();
+    for (size_t k = 0; k < n_segments; k++) {
+      while (!check_segment(k)) {
+      }
+      for (size_t dest : children)
+        done = upcxx::when_all(done, put_slices(dest, k, k));
+    }
+    return done;
+  }
+
+  // Children of this process in a binary tree rooted at `root` (heap
+  // order over ranks relative to the root). Each rank forwards every
+  // segment at most twice, so the pipeline costs about 2n/B plus a
+  // log(P)-deep fill, instead of the log(P) full sends an MST root makes.
+  std::vector<size_t> pipeline_children(size_t root) {
+    std::vector<size_t> children;
+    size_t n = upcxx::rank_n();
+    size_t rel = (upcxx::rank_me() + n - root) % n;
+    for (size_t c = 2 * rel + 1; c <= 2 * rel + 2 && c < n; c++)
+      children.push_back((c + root) % n);
+    return children;
+  }
+
+  // Two-level broadcast. The MST runs only among one leader per
+  // local_team, so each node receives the message once over the network.
+  // The other ranks on a node then copy it out of their leader's buffer
+  // through shared memory, segment by segment as it lands. A root that is
+  // not a leader first hands the message to its own leader.
+  upcxx::future<> broadcast_hierarchical(size_t root) {
+    const upcxx::team& local = upcxx::local_team();
+    size_t me = upcxx::rank_me();
+    size_t leader = local[0];
+
+    if (me == root && me != leader && !shared_buffer) {
+      while (!check_ready()) {
+      }
+      put_slices(leader, 0, n_segments - 1).wait();
+    }
+
+    if (me == leader) {
+      size_t root_node = resolve(root).node;
+      std::vector<size_t> children;
+      for (size_t child : bcast_tree::mst_children(root_node, leaders.rank_me(), leaders.rank_n()))
+        children.push_back(leaders[child]);
+      probe_receivers(children, epoch);
+      for (size_t child : children) {
+        while (!check_ready()) {
+        }
+        put_slices(child, 0, n_segments - 1).wait();
+      }
+      // Keep the buffer stable until every rank on the node has copied it.
+      for (int i = 1; i < local.rank_n() && !shared_buffer; i++) {
+        volatile uint64_t* flags = resolve(local[i]).flags.local();
+        for (size_t k = 0; k < n_segments; k++) {
+          while (flags[k] < epoch) {
+            upcxx::progress();
+          }
+        }
+      }
+    } else if (me != root && !shared_buffer) {
+      peer& src = resolve(leader);
+      volatile uint64_t* src_flags = src.flags.local();
+      for (size_t k = 0; k < n_segments; k++) {
+        while (src_flags[k] < epoch) {
+          upcxx::progress();
+        }
+        size_t offset = k * segment_size;
+        size_t count = std::min(segment_size, bcast_size - offset);
+        std::copy(src.data.local() + offset, src.data.local() + offset + count,
+                  my_data() + offset);
+        local_flags()[k] = epoch;
+      }
+    }
+    return upcxx::make_future();
+  }
+
+  // This rank's place in `tree` for broadcasts from `root`, computed on
+  // the first one and again only once `tree` has changed, with the
+  // children's pointers fetched together.
+  const tree_schedule& schedule_for(size_t root) {
+    auto it = schedules.find(root);
+    if (it != schedules.end() && it->second.tree == tree)
+      return it->second;
+    size_t me = upcxx::rank_me();
+    tree_schedule& s = schedules[root];
+    s.tree = tree;
+    s.rounds = tree.rounds(root, me, upcxx::rank_n());
+    s.children.clear();
+    for (const auto& round : s.rounds)
+      s.children.insert(s.children.end(), round.begin(), round.end());
+    s.ancestors = tree.ancestors(root, me, upcxx::rank_n());
+    resolve(s.children);
+    return s;
+  }
+
+  // Broadcast down `tree`. Once the data is here a forwarder puts it to
+  // all children of a round at once, so a radix-k tree keeps up to k-1
+  // puts in flight, and moves on when they have completed.
+  upcxx::future<> broadcast_tree(size_t root) {
+    const tree_schedule& s = schedule_for(root);
+    if (s.rounds.empty())
+      return upcxx::make_future();
+    probe_receivers(s.children, epoch);
+    while (!check_ready()) {
+    }
+    for (const auto& round : s.rounds) {
+      upcxx::future<> done = upcxx::make_future();
+      for (size_t dest : round)
+        done = upcxx::when_all(done, put_slices(dest, 0, n_segments - 1));
+      done.wait();
+    }
+    return upcxx::make_future();
+  }
+
+  // LL broadcast down `tree`. A forwarder spins on its receive lines for
+  // this epoch, hands them on unchanged to all of its children at once,
+  // and only then unpacks them into my_data(). The root packs its data
+  // into its own lines first. The future tracks the forwarding puts.
+  upcxx::future<> broadcast_ll(size_t root) {
+    size_t me = upcxx::rank_me();
+    size_t n_lines = ll_lines();
+    uint64_t* lines = mine->ll.local() + (epoch % 2) * n_lines;
+    uint64_t tag = (epoch & 0xffffffff) << 32;
+    // The slot being overwritten last held epoch - 2.
+    const std::vector<size_t>& children = schedule_for(root).children;
+    probe_receivers(children, epoch - 1);
+    if (me == root) {
+      while (!check_ready()) {
+      }
+      ll_pack(send_buffer(), lines, tag);
+    } else {
+      volatile uint64_t* in = lines;
+      for (size_t i = 0; i < n_lines; i++) {
+        while ((in[i] >> 32) != (tag >> 32)) {
+          trace.waiting(epoch);
+          upcxx::progress();
+        }
+      }
+    }
+
+    upcxx::future<> done = upcxx::make_future();
+    for (size_t dest : children) {
+      size_t id = trace.put_begin(epoch, dest, n_lines * sizeof(uint64_t));
+      window.acquire(n_lines * sizeof(uint64_t));
+      upcxx::global_ptr<uint64_t> slot = resolve(dest).ll + (epoch % 2) * n_lines;
+      done = upcxx::when_all(done, window.track(traced(
+        receiver_opened(dest, epoch - 1).then([this, id, lines, slot, n_lines]() -> upcxx::future<> {
+            trace.put_issued(id);
+            return upcxx::rput(lines, slot, n_lines);
+          }), id), n_lines * sizeof(uint64_t)));
+    }
+
+    if (me != root) {
+      ll_unpack(lines, my_data());
+      std::fill(local_flags(), local_flags() + n_segments, epoch);
+      trace.arrived(epoch);
+    }
+    return done;
+  }
+
+  // The root of a pull broadcast is the one source that is sure to stay,
+  // so before changing its buffer it waits until every rank has opened
+  // the next epoch, i.e. has fetched or dropped this one. The reads of
+  // their open words all go out at once.
+  void release_pull_source() {
+    if (pull_served != epoch || epoch == 0)
+      return;
+    std::vector<size_t> others;
+    for (size_t r = 0; r < upcxx::rank_n(); r++) {
+      if (r != upcxx::rank_me())
+        others.push_back(r);
+    }
+    resolve(others);
+    upcxx::future<> opened = upcxx::make_future();
+    for (size_t r : others)
+      opened = upcxx::when_all(opened, receiver_opened(r, epoch + 1));
+    opened.wait();
+    pull_served = 0;
+  }
+
+  // Receiver-driven broadcast. A non-root rank fetches the whole buffer
+  // with one rget from a rank that holds this epoch's data, which it
+  // checks by reading that rank's last segment flag and open word: both
+  // must equal the epoch. It prefers its parent in `tree`; every other
+  // probe goes to an ancestor further up or to a random rank nearer the
+  // root instead, so a late parent costs its subtree a few probes rather
+  // than the whole wait, and ranks that got the data early end up serving
+  // it. Nothing happens here beyond setup: the transfer starts on the
+  // first check_ready() and advances on each one, and a rank that never
+  // polls before opening the next epoch never fetches at all.
+  //
+  // Any source other than the root may open the next epoch, and then be
+  // overwritten, while the rget is in flight, and the root of the next
+  // one may restage its buffer. So the source's flag and open word are
+  // read again once the data is here, and the copy is only kept if they
+  // still show the epoch; otherwise the rank probes again.
+  upcxx::future<> broadcast_pull(size_t root) {
+    size_t me = upcxx::rank_me();
+    if (me == root) {
+      pull_served = epoch;
+      return upcxx::make_future();
+    }
+    pulling.ancestors = schedule_for(root).ancestors;
+    resolve(pulling.ancestors);
+    pulling.epoch = epoch;
+    pulling.root = root;
+    pulling.state = pull_state::idle;
+    pulling.probes = 0;
+    return upcxx::make_future();
+  }
+
+  // Next rank to probe: the parent on even probes; otherwise, in turn, the
+  // next ancestor up or a random rank nearer the root than this one.
+  size_t pull_source() {
+    size_t k = pulling.probes++;
+    if (k % 2 == 0 || pulling.ancestors.size() == 1)
+      return pulling.ancestors[0];
+    size_t n = upcxx::rank_n();
+    size_t rel = (upcxx::rank_me() + n - pulling.root) % n;
+    if (k % 4 == 1 || rel < 2)
+      return pulling.ancestors[1 + (k / 4) % (pulling.ancestors.size() - 1)];
+    pull_seed = pull_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    size_t earlier = 1 + (pull_seed >> 33) % (rel - 1);
+    return (earlier + pulling.root) % n;
+  }
+
+  bool pull_pending() const {
+    return pulling.epoch != 0 && pulling.epoch == epoch;
+  }
+
+  // One step of the pull in progress; true once its data is here.
+  bool advance_pull() {
+    if (!pulling.pending.ready())
+      return false;
+    switch (pulling.state) {
+      case pull_state::idle:
+        pulling.source = pull_source();
+        pulling.state = pull_state::probing;
+        pulling.pending = upcxx::rget(flag_ptr(pulling.source) + n_segments - 1, pulling.seen, 2);
+        return false;
+      case pull_state::probing:
+        if (pulling.seen[0] != epoch || pulling.seen[1] != epoch) {
+          pulling.state = pull_state::idle;
+          return false;
+        }
+        pulling.state = pull_state::fetching;
+        pulling.trace_id = trace.get_begin(epoch, pulling.source, bcast_size * sizeof(T));
+        pulling.pending = upcxx::rget(data_ptr(pulling.source), my_data(), bcast_size)
+        .then([this](){
+            trace.put_completed(pulling.trace_id);
+            return upcxx::rget(flag_ptr(pulling.source) + n_segments - 1, pulling.seen, 2);
+          });
+        return false;
+      case pull_state::fetching:
+        if (pulling.seen[0] != epoch || pulling.seen[1] != epoch) {
+          pulling.state = pull_state::idle;
+          return false;
+        }
+        std::fill(local_flags(), local_flags() + n_segments, epoch);
+        pulling.epoch = 0;
+        pulling.state = pull_state::idle;
+        return true;
+    }
+    return false;
+  }
+
+  // Number of 8-byte LL words holding the buffer, 4 bytes each.
+  size_t ll_lines() const {
+    return (bcast_size * sizeof(T) + 3) / 4;
+  }
+
+  void ll_pack(const T* data, uint64_t* lines, uint64_t tag) {
+    const char* bytes = reinterpret_cast<const char*>(data);
+    size_t n_bytes = bcast_size * sizeof(T);
+    for (size_t i = 0; i < ll_lines(); i++) {
+      uint32_t word = 0;
+      memcpy(&word, bytes + 4 * i, std::min<size_t>(4, n_bytes - 4 * i));
+      lines[i] = tag | word;
+    }
+  }
+
+  void ll_unpack(const uint64_t* lines, T* data) {
+    char* bytes = reinterpret_cast<char*>(data);
+    size_t n_bytes = bcast_size * sizeof(T);
+    for (size_t i = 0; i < ll_lines(); i++) {
+      uint32_t word = (uint32_t) lines[i];
+      memcpy(bytes + 4 * i, &word, std::min<size_t>(4, n_bytes - 4 * i));
+    }
+  }
+
+  // Van de Geijn broadcast: scatter one slice (segment) per rank down the
+  // MST, then pass slices around a ring until every rank holds all of them.
+  // Each link carries about n/P elements per step instead of the full
+  // message. Expects the buffer to be split into ceil(n/P)-element segments.
+  upcxx::future<> broadcast_scatter_allgather(size_t bcast_root) {
+    size_t me = upcxx::rank_me();
+    size_t n = upcxx::rank_n();
+    upcxx::future<> done = upcxx::make_future();
+    std::vector<size_t> receivers = bcast_tree::mst_children(bcast_root, me, n);
+    receivers.push_back((me + 1) % n);
+    probe_receivers(receivers, epoch);
+
+    // Scatter: the sender hands `dest` the slices of dest's half.
+    size_t root = bcast_root;
+    size_t left = 0;
+    size_t right = n - 1;
+    while (left != right) {
+      size_t mid = left + (right - left) / 2;
+      size_t dest = (root <= mid) ? right: left;
+      if (me == root) {
+        size_t lo = (dest <= mid) ? left : mid + 1;
+        size_t hi = (dest <= mid) ? mid : right;
+        while (!check_slices(lo, hi)) {
+        }
+        done = upcxx::when_all(done, put_slices(dest, lo, hi));
+      }
+
+      if (me <= mid) {
+        if (root > mid)
+          root = dest;
+        right = mid;
+      } else {
+        if (root <= mid)
+          root = dest;
+        left = mid + 1;
+      }
+    }
+
+    // Ring allgather: at step s pass slice (me - s) on to the next rank,
+    // skipping slices it already got during the scatter.
+    size_t next = (me + 1) % n;
+    std::pair<size_t, size_t> held = scatter_range(next, bcast_root);
+    for (size_t s = 0; s + 1 < n; s++) {
+      size_t k = (me + n - s) % n;
+      if (k >= n_segments || (k >= held.first && k <= held.second))
+        continue;
+      while (!check_segment(k)) {
+      }
+      done = upcxx::when_all(done, put_slices(next, k, k));
+    }
+    return done;
+  }
+
+  // Range of slices rank `x` holds once the scatter from `root` is done.
+  std::pair<size_t, size_t> scatter_range(size_t x, size_t root) {
+    size_t left = 0;
+    size_t right = upcxx::rank_n() - 1;
+    while (x != root) {
+      size_t mid = left + (right - left) / 2;
+      size_t dest = (root <= mid) ? right: left;
+      if (x <= mid) {
+        if (root > mid)
+          root = dest;
+        right = mid;
+      } else {
+        if (root <= mid)
+          root = dest;
+        left = mid + 1;
+      }
+    }
+    return {left, right};
+  }
+
+  // Put slices [lo, hi] to `dest` and set their flags there with
+  // SignalPolicy, once `dest` has opened the epoch (see receiver_opened).
+  upcxx::future<> put_slices(size_t dest, size_t lo, size_t hi) {
+    hi = std::min(hi, n_segments - 1);
+    if (lo > hi)
+      return upcxx::make_future();
+    size_t offset = lo * segment_size;
+    size_t count = std::min(bcast_size, (hi + 1) * segment_size) - offset;
+    size_t n_flags = hi - lo + 1;
+    uint64_t e = epoch;
+    size_t id = trace.put_begin(e, dest, count * sizeof(T));
+    window.acquire(count * sizeof(T));
+    const T* src = send_buffer() + offset;
+    upcxx::global_ptr<T> dst = data_ptr(dest) + offset;
+    upcxx::global_ptr<uint64_t> flags = flag_ptr(dest) + lo;
+    return window.track(traced(receiver_opened(dest, e).then([=](){
+        trace.put_issued(id);
+        return SignalPolicy::put([=](auto&& cx){
+            return upcxx::rput(src, dst, count, std::forward<decltype(cx)>(cx));
+          }, flags, n_flags, e);
+      }), id), count * sizeof(T));
+  }
+
+  // `done` with trace put `id` marked complete when it is ready.
+  upcxx::future<> traced(upcxx::future<> done, size_t id) {
+    if (!Trace::enabled)
+      return done;
+    return done.then([this, id](){
+        trace.put_completed(id);
+      });
+  }
+
+  bool check_slices(size_t lo, size_t hi) {
+    for (size_t k = lo; k <= hi && k < n_segments; k++) {
+      if (!check_segment(k))
+        return false;
+    }
+    return true;
+  }
+
+  // Own flags live in this rank's shared segment, so readiness is a plain
+  // load. progress() runs the signaling RPCs that set them.
+  volatile uint64_t* local_flags() {
+    return mine->flags.local();
+  }
+
+  // Flags of the segments my_data() points at: the node leader's with
+  // shared_buffer, otherwise local_flags().
+  volatile uint64_t* segment_flags() {
+    return node_flags.local();
+  }
+
+  // Run the signaling RPCs and any pull in progress, once per poll.
+  void poll() {
+    upcxx::progress();
+    if (pull_pending())
+      advance_pull();
+  }
+
+  bool check_segment(size_t k) {
+    poll();
+    if (segment_flags()[k] >= epoch)
+      return true;
+    trace.waiting(epoch);
+    return false;
+  }
+
+  bool check_ready() {
+    poll();
+    if (!scan_prefix()) {
+      trace.waiting(epoch);
+      return false;
+    }
+    trace.arrived(epoch);
+    return true;
+  }
+
+  // Move prefix_segments past the segments of this epoch that are here;
+  // true once that is all of them. Each scan resumes where the last one
+  // stopped, so polling a buffer that has mostly arrived reads one line
+  // of flags rather than all of them.
+  bool scan_prefix() {
+    if (prefix_epoch != epoch) {
+      prefix_epoch = epoch;
+      prefix_segments = 0;
+    }
+    volatile uint64_t* flags = segment_flags();
+    while (prefix_segments < n_segments && flags[prefix_segments] >= epoch)
+      prefix_segments++;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return prefix_segments == n_segments;
+  }
+
+  // Streaming receive: the current broadcast's data in segments, usable
+  // as each one arrives instead of after the last. Elements are those of
+  // my_data(); a zero-copy root holds its data in its own source instead.
+
+  // Number of leading elements of the data that are here.
+  size_t ready_prefix() {
+    poll();
+    scan_prefix();
+    return std::min(bcast_size, prefix_segments * segment_size);
+  }
+
+  // True once elements [begin, end) are here; `end` is clamped to the
+  // buffer, so wait_range(0, SIZE_MAX) waits for all of it.
+  bool test_range(size_t begin, size_t end) {
+    end = std::min(end, bcast_size);
+    if (begin >= end)
+      return true;
+    poll();
+    volatile uint64_t* flags = segment_flags();
+    for (size_t k = begin / segment_size; k <= (end - 1) / segment_size; k++) {
+      if (flags[k] < epoch) {
+        trace.waiting(epoch);
+        return false;
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+  }
+
+  void wait_range(size_t begin, size_t end) {
+    while (!test_range(begin, end)) {
+    }
+  }
+
+  // Call func(offset, count) for every segment that has arrived since the
+  // last call in this epoch, in the order they were seen. Returns true
+  // once all of them have been passed to `func`.
+  template <typename Func>
+  bool poll_chunks(Func&& func) {
+    if (chunks_epoch != epoch) {
+      chunks_epoch = epoch;
+      chunk_seen.assign(n_segments, false);
+      chunks_first = 0;
+      chunks_left = n_segments;
+    }
+    poll();
+    volatile uint64_t* flags = segment_flags();
+    for (size_t k = chunks_first; k < n_segments && chunks_left > 0; k++) {
+      if (chunk_seen[k] || flags[k] < epoch)
+        continue;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      chunk_seen[k] = true;
+      chunks_left--;
+      size_t offset = k * segment_size;
+      func(offset, std::min(segment_size, bcast_size - offset));
+    }
+    while (chunks_first < n_segments && chunk_seen[chunks_first])
+      chunks_first++;
+    if (chunks_left > 0) {
+      trace.waiting(epoch);
+      return false;
+    }
+    trace.arrived(epoch);
+    return true;
+  }
+
+  // Block, passing every segment to func(offset, count) as it arrives.
+  template <typename Func>
+  void for_each_chunk(Func&& func) {
+    while (!poll_chunks(func)) {
+    }
+  }
+
+  // Zero-copy alternative to the vector init_root: the root sends straight
+  // out of `data` (local, bcast_size elements), which must stay unchanged
+  // until its broadcast future is ready. Nothing is copied into my_data().
+  void init_root(upcxx::global_ptr<T> data, size_t root) {
+    if (upcxx::rank_me() == root) {
+      source = data.local();
+      source_epoch = epoch + 1;
+    }
+  }
+
+  // Called by the root of a zero-copy broadcast once the epoch is open.
+  // Hierarchical, shared_buffer and pull broadcasts have other ranks read
+  // the root's own buffer, so there the source is copied in after all.
+  void inject_source(bcast_algorithm alg) {
+    if (shared_buffer || alg == bcast_algorithm::hierarchical || alg == bcast_algorithm::pull) {
+      if (shared_buffer)
+        wait_node_opened(epoch);
+      if (source != my_data())
+        std::copy(source, source + bcast_size, my_data());
+      source_epoch = 0;
+    }
+    std::fill(segment_flags(), segment_flags() + n_segments, epoch);
+  }
+
+  // Where this rank's puts read from: the root's zero-copy source during
+  // its broadcast, otherwise my_data().
+  const T* send_buffer() {
+    return (source_epoch == epoch) ? source : my_data();
+  }
+
+  // Stage `data` on `root` for the next broadcast() call. The root's
+  // previous broadcast future must be ready; its data, or a pull of it
+  // still in flight, is waited for first so it cannot overwrite `data`.
+  void init_root(const std::vector<T>& data, size_t root){
+    if (upcxx::rank_me() == root) {
+      settle_epoch();
+      release_pull_source();
+      if (shared_buffer) {
+        // The root is done with the old data too; say so before waiting,
+        // or a leader opening the epoch would wait on us in turn.
+        local_flags()[n_segments] = epoch + 1;
+        wait_node_opened(epoch + 1);
+      }
+      // Mark the buffer as changing first, so a rank pulling the previous
+      // epoch from it sees its copy may be torn.
+      std::fill(segment_flags(), segment_flags() + n_segments, 0);
+      upcxx::rput(data.data(), data_ptr(root), data.size()).wait();
+      std::fill(segment_flags(), segment_flags() + n_segments, epoch + 1);
+    }
+  }
+
+  T* my_data() {
+    return mine->data.local();
+  }
+
+  size_t bcast_size, segment_size, n_segments;
+  // Current broadcast number; the same on every rank.
+  uint64_t epoch;
+  // Tree for bcast_algorithm::tree, the LL protocol and pull broadcasts.
+  TreePolicy tree;
+  // Schedules by root, for the roots this rank has seen.
+  std::unordered_map<size_t, tree_schedule> schedules;
+  // Bounds the puts this rank has in flight, for every algorithm.
+  put_window window;
+  // Per-hop records; empty with no_trace.
+  Trace trace;
+  // The pull broadcast this rank still has to fetch, if any.
+  struct pull_state {
+    enum { idle, probing, fetching } state = idle;
+    // Epoch being pulled (0: none), its root and the rank being tried.
+    uint64_t epoch = 0;
+    size_t root = 0, source = 0;
+    // Parent, its parent and so on up to the root.
+    std::vector<size_t> ancestors;
+    size_t probes = 0;
+    // The source's last segment flag and open word, as last read.
+    uint64_t seen[2] = {0, 0};
+    upcxx::future<> pending = upcxx::make_future();
+    size_t trace_id = 0;
+  } pulling;
+  // Epoch of the last pull broadcast rooted here, until released.
+  uint64_t pull_served = 0;
+  uint64_t pull_seed = 1 + upcxx::rank_me();
+  // Buffers of at most this many bytes use the LL protocol for every
+  // algorithm (0: only when asked for with bcast_algorithm::ll).
+  size_t ll_threshold = 0;
+  // Segments known to be here from the front, for scan_prefix().
+  uint64_t prefix_epoch = 0;
+  size_t prefix_segments = 0;
+  // Segments already passed on by poll_chunks() this epoch.
+  uint64_t chunks_epoch = 0;
+  std::vector<bool> chunk_seen;
+  size_t chunks_first = 0, chunks_left = 0;
+  // One read-only buffer per node instead of one per rank.
+  bool shared_buffer;
+  // Caller-provided receive buffer, or null.
+  upcxx::global_ptr<T> user_buffer;
+  // Zero-copy root source and the epoch it is for (0: none).
+  const T* source = nullptr;
+  uint64_t source_epoch = 0;
+  // Segment flags guarding my_data(); see segment_flags().
+  upcxx::global_ptr<uint64_t> node_flags;
+  // One rank per node (local_team rank 0); other ranks hold an invalid team.
+  upcxx::team leaders;
+  // This rank's pointers, published for lazy lookup by the others.
+  upcxx::dist_object<peer> mine;
+  // Pointers of the ranks this process has talked to.
+  std::unordered_map<size_t, peer> peers;
+  // Open-word read in flight per receiver, and the epoch it waits for.
+  struct open_probe {
+    uint64_t epoch = 0;
+    upcxx::future<> ready = upcxx::make_future();
+  };
+  std::unordered_map<size_t, open_probe> open_probes;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "bcast_signal.hpp"
+#include "broadcast_data.hpp"
+#include "tree.hpp"
+
+// Single-segment broadcast with the tree, the signaling and the progress
+// model as template policies, so each configuration compiles to its own
+// forwarding path with nothing left to decide at run time:
+//
+//   collective<double, knomial_tree<4>, fused_signal, polled_progress> b(n);
+//
+// The protocol, flags and puts are broadcast_data's, instantiated with the
+// same tree and signal policies (see tree.hpp and bcast_signal.hpp); this
+// only adds the progress model. A rank's children for a root come from
+// the engine's schedule_for(), built the first time it broadcasts from
+// that root and reused by every later broadcast.
+
+// Progress policies. With eager_progress, broadcast() waits for the data
+// and issues every forwarding put before it returns. With polled_progress
+// it only posts the broadcast, and each test() forwards what can go
+// without blocking.
+struct eager_progress {
+  static constexpr bool blocking = true;
+};
+
+struct polled_progress {
+  static constexpr bool blocking = false;
+};
+
+template <typename T, typename TreePolicy = knomial_tree<2>,
+          typename SignalPolicy = fused_signal, typename ProgressPolicy = eager_progress>
+struct collective {
+  // Collective: every rank constructs its collective together.
+  explicit collective(size_t n)
+    : engine(n), window(engine.window) {}
+
+  // Stage `data` on `root` for the next broadcast(). The root's previous
+  // broadcast must be complete.
+  void init_root(const std::vector<T>& data, size_t root) {
+    engine.init_root(data, root);
+  }
+
+  // Broadcast the root's staged data; every rank calls this once per
+  // broadcast, after this rank's previous one is complete. With
+  // eager_progress the future tracks this rank's forwarding puts, like
+  // broadcast_data's, and check_ready() tells when the data is here. With
+  // polled_progress it is ready once both are done, from within test(),
+  // which must be polled until it returns true.
+  upcxx::future<> broadcast(size_t root) {
+    engine.open_epoch();
+    current = &engine.schedule_for(root).children;
+    engine.probe_receivers(*current, engine.epoch);
+    next_child = 0;
+    sent = upcxx::make_future();
+    finished = false;
+    done = upcxx::promise<>();
+    forward();
+    if (ProgressPolicy::blocking) {
+      finished = true;
+      return sent;
+    }
+    return done.get_future();
+  }
+
+  // Hot path: put to every child whose turn has come. Returns true once all
+  // of them have been sent to; only blocks with eager_progress. A put whose
+  // receiver has not opened the epoch yet is queued behind the read of its
+  // open word (see broadcast_data::receiver_opened), not waited for.
+  bool forward() {
+    const std::vector<size_t>& children = *current;
+    size_t bytes = engine.bcast_size * sizeof(T);
+    while (next_child < children.size()) {
+      if (!check_ready() || !window.try_acquire(bytes)) {
+        if (!ProgressPolicy::blocking)
+          return false;
+        continue;
+      }
+      sent = upcxx::when_all(sent, engine.put_slices(children[next_child], 0,
+                                                     engine.n_segments - 1));
+      next_child++;
+    }
+    return true;
+  }
+
+  // Drive this rank's part of the broadcast. True once the data is here
+  // and every forwarding put has completed.
+  bool test() {
+    if (finished)
+      return check_ready() && sent.ready();
+    if (forward() && check_ready() && sent.ready()) {
+      finished = true;
+      done.fulfill_anonymous(1);
+    }
+    return finished;
+  }
+
+  void wait() {
+    while (!test()) {
+    }
+  }
+
+  bool check_ready() {
+    return engine.check_ready();
+  }
+
+  T* my_data() {
+    return engine.my_data();
+  }
+
+  // Buffers, flags and puts, with this collective's tree and signaling.
+  broadcast_data<T, no_trace, SignalPolicy, TreePolicy> engine;
+  // Bounds this rank's forwarding puts in flight; the engine's.
+  put_window& window;
+  // The broadcast in progress: this rank's children, the next one to send to,
+  // the puts sent so far and, with polled_progress, the promise test()
+  // fulfills.
+  const std::vector<size_t>* current = nullptr;
+  size_t next_child = 0;
+  upcxx::future<> sent = upcxx::make_future();
+  upcxx::promise<> done;
+  bool finished = true;
+};
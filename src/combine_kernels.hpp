@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Reduction operators and the kernels folding one vector into another,
+// dst[i] = dst[i] op src[i]. int, float and double use SSE2 or, when the
+// compiler targets it, AVX2; other types and the leftover tail are scalar.
+enum class reduce_op { sum, min, max };
+
+inline const char* reduce_op_name(reduce_op op) {
+  switch (op) {
+    case reduce_op::sum: return "sum";
+    case reduce_op::min: return "min";
+    case reduce_op::max: return "max";
+  }
+  return "unknown";
+}
+
+inline bool parse_reduce_op(const char* name, reduce_op& op) {
+  const reduce_op all[] = {reduce_op::sum, reduce_op::min, reduce_op::max};
+  for (reduce_op o : all) {
+    if (strcmp(name, reduce_op_name(o)) == 0) {
+      op = o;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Vector width and operations for one element type; `enabled` is false
+// where there is no SIMD version.
+template <typename T>
+struct simd_traits {
+  static constexpr bool enabled = false;
+};
+
+#if defined(__AVX2__)
+template <>
+struct simd_traits<double> {
+  static constexpr bool enabled = true;
+  static constexpr size_t width = 4;
+  typedef __m256d vec;
+  static vec load(const double* p) { return _mm256_loadu_pd(p); }
+  static void store(double* p, vec v) { _mm256_storeu_pd(p, v); }
+  static vec add(vec a, vec b) { return _mm256_add_pd(a, b); }
+  static vec min(vec a, vec b) { return _mm256_min_pd(a, b); }
+  static vec max(vec a, vec b) { return _mm256_max_pd(a, b); }
+};
+
+template <>
+struct simd_traits<float> {
+  static constexpr bool enabled = true;
+  static constexpr size_t width = 8;
+  typedef __m256 vec;
+  static vec load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, vec v) { _mm256_storeu_ps(p, v); }
+  static vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+  static vec min(vec a, vec b) { return _mm256_min_ps(a, b); }
+  static vec max(vec a, vec b) { return _mm256_max_ps(a, b); }
+};
+
+template <>
+struct simd_traits<int> {
+  static constexpr bool enabled = true;
+  static constexpr size_t width = 8;
+  typedef __m256i vec;
+  static vec load(const int* p) { return _mm256_loadu_si256((const __m256i*) p); }
+  static void store(int* p, vec v) { _mm256_storeu_si256((__m256i*) p, v); }
+  static vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+  static vec min(vec a, vec b) { return _mm256_min_epi32(a, b); }
+  static vec max(vec a, vec b) { return _mm256_max_epi32(a, b); }
+};
+#elif defined(__SSE2__)
+template <>
+struct simd_traits<double> {
+  static constexpr bool enabled = true;
+  static constexpr size_t width = 2;
+  typedef __m128d vec;
+  static vec load(const double* p) { return _mm_loadu_pd(p); }
+  static void store(double* p, vec v) { _mm_storeu_pd(p, v); }
+  static vec add(vec a, vec b) { return _mm_add_pd(a, b); }
+  static vec min(vec a, vec b) { return _mm_min_pd(a, b); }
+  static vec max(vec a, vec b) { return _mm_max_pd(a, b); }
+};
+
+template <>
+struct simd_traits<float> {
+  static constexpr bool enabled = true;
+  static constexpr size_t width = 4;
+  typedef __m128 vec;
+  static vec load(const float* p) { return _mm_loadu_ps(p); }
+  static void store(float* p, vec v) { _mm_storeu_ps(p, v); }
+  static vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+  static vec min(vec a, vec b) { return _mm_min_ps(a, b); }
+  static vec max(vec a, vec b) { return _mm_max_ps(a, b); }
+};
+
+template <>
+struct simd_traits<int> {
+  static constexpr bool enabled = true;
+  static constexpr size_t width = 4;
+  typedef __m128i vec;
+  static vec load(const int* p) { return _mm_loadu_si128((const __m128i*) p); }
+  static void store(int* p, vec v) { _mm_storeu_si128((__m128i*) p, v); }
+  static vec add(vec a, vec b) { return _mm_add_epi32(a, b); }
+  // SSE2 has no 32-bit integer min/max: select through a compare mask.
+  static vec min(vec a, vec b) {
+    vec gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+  }
+  static vec max(vec a, vec b) {
+    vec gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+  }
+};
+#endif
+
+struct combine_sum {
+  template <typename T>
+  static T apply(T a, T b) { return a + b; }
+  template <typename S>
+  static typename S::vec apply_vec(typename S::vec a, typename S::vec b) { return S::add(a, b); }
+};
+
+// Scalar min/max pick `b` unless `a` is strictly better, like minpd/maxpd.
+struct combine_min {
+  template <typename T>
+  static T apply(T a, T b) { return (a < b) ? a : b; }
+  template <typename S>
+  static typename S::vec apply_vec(typename S::vec a, typename S::vec b) { return S::min(a, b); }
+};
+
+struct combine_max {
+  template <typename T>
+  static T apply(T a, T b) { return (a > b) ? a : b; }
+  template <typename S>
+  static typename S::vec apply_vec(typename S::vec a, typename S::vec b) { return S::max(a, b); }
+};
+
+// Whole vectors of dst and src; returns how many elements were done.
+template <typename Op, typename T>
+size_t combine_vectors(T* dst, const T* src, size_t n, std::true_type) {
+  typedef simd_traits<T> S;
+  size_t i = 0;
+  for (; i + S::width <= n; i += S::width)
+    S::store(dst + i, Op::template apply_vec<S>(S::load(dst + i), S::load(src + i)));
+  return i;
+}
+
+template <typename Op, typename T>
+size_t combine_vectors(T*, const T*, size_t, std::false_type) {
+  return 0;
+}
+
+template <typename Op, typename T>
+void combine_kernel(T* dst, const T* src, size_t n) {
+  size_t i = combine_vectors<Op>(dst, src, n,
+    std::integral_constant<bool, simd_traits<T>::enabled>());
+  for (; i < n; i++)
+    dst[i] = Op::apply(dst[i], src[i]);
+}
+
+template <typename T>
+void combine(reduce_op op, T* dst, const T* src, size_t n) {
+  switch (op) {
+    case reduce_op::sum: combine_kernel<combine_sum>(dst, src, n); break;
+    case reduce_op::min: combine_kernel<combine_min>(dst, src, n); break;
+    case reduce_op::max: combine_kernel<combine_max>(dst, src, n); break;
+  }
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Compute kernels to overlap with a broadcast. Unlike a sleep they compete
+// with the RDMA traffic for memory bandwidth, caches and cores. None of them
+// calls into UPC++, so they can run on a thread without a persona.
+enum class compute_kernel { sleep, triad, dgemm, consume };
+
+inline const char* compute_kernel_name(compute_kernel kernel) {
+  switch (kernel) {
+    case compute_kernel::sleep: return "sleep";
+    case compute_kernel::triad: return "triad";
+    case compute_kernel::dgemm: return "dgemm";
+    case compute_kernel::consume: return "consume";
+  }
+  return "unknown";
+}
+
+// Kernels named in the comma-separated `list`, or all of them.
+inline std::vector<compute_kernel> parse_compute_kernels(const char* list) {
+  const compute_kernel all[] = {compute_kernel::sleep, compute_kernel::triad,
+                                compute_kernel::dgemm, compute_kernel::consume};
+  std::vector<compute_kernel> kernels;
+  std::string names = (list == nullptr) ? "" : std::string(",") + list + ",";
+  for (compute_kernel kernel : all) {
+    if (list == nullptr || names.find(std::string(",") + compute_kernel_name(kernel) + ",") != std::string::npos)
+      kernels.push_back(kernel);
+  }
+  return kernels;
+}
+
+// STREAM triad a = b + s * c over `n` doubles, `reps` times: memory bound.
+struct triad_kernel {
+  std::vector<double> a, b, c;
+  size_t reps;
+
+  triad_kernel(size_t n, size_t reps) : a(n, 0), b(n, 1), c(n, 2), reps(reps) {}
+
+  // Returns a checksum so the loop is not optimized away.
+  double run() {
+    double s = 3;
+    for (size_t r = 0; r < reps; r++) {
+      for (size_t i = 0; i < a.size(); i++)
+        a[i] = b[i] + s * c[i];
+    }
+    return a[a.size() / 2];
+  }
+};
+
+// C += A * B on `n` x `n` matrices in `block` x `block` tiles, `reps`
+// times: compute bound once the tiles fit in cache.
+struct dgemm_kernel {
+  size_t n, block, reps;
+  std::vector<double> A, B, C;
+
+  dgemm_kernel(size_t n, size_t block, size_t reps)
+    : n(n), block(std::max<size_t>(1, std::min(block, n))), reps(reps),
+      A(n * n, 1), B(n * n, 0.5), C(n * n, 0) {}
+
+  double run() {
+    for (size_t r = 0; r < reps; r++) {
+      for (size_t ii = 0; ii < n; ii += block) {
+        for (size_t kk = 0; kk < n; kk += block) {
+          for (size_t jj = 0; jj < n; jj += block) {
+            size_t i_end = std::min(ii + block, n);
+            size_t k_end = std::min(kk + block, n);
+            size_t j_end = std::min(jj + block, n);
+            for (size_t i = ii; i < i_end; i++) {
+              for (size_t k = kk; k < k_end; k++) {
+                double a = A[i * n + k];
+                for (size_t j = jj; j < j_end; j++)
+                  C[i * n + j] += a * B[k * n + j];
+              }
+            }
+          }
+        }
+      }
+    }
+    return C[n * n / 2];
+  }
+};
+
+// `passes` passes over the `count` elements of `data` at `offset`.
+template <typename T>
+double consume_chunk(const T* data, size_t offset, size_t count, size_t passes) {
+  double sum = 0;
+  for (size_t p = 0; p < passes; p++) {
+    for (size_t i = offset; i < offset + count; i++)
+      sum += data[i] * (p + 1);
+  }
+  return sum;
+}
+
+// Consume broadcast data as it arrives: wait for each segment's flag to
+// reach `epoch`, then make `passes` passes over it. `data` and `flags` are
+// a broadcast_data's my_data() and segment_flags(), fetched by the thread
+// that drives the broadcast.
+template <typename T>
+double consume_segments(const T* data, volatile uint64_t* flags, uint64_t epoch,
+                        size_t n, size_t segment_size, size_t passes) {
+  double sum = 0;
+  size_t n_segments = (n + segment_size - 1) / segment_size;
+  for (size_t k = 0; k < n_segments; k++) {
+    while (flags[k] < epoch) {
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    sum += consume_chunk(data, k * segment_size, std::min(segment_size, n - k * segment_size), passes);
+  }
+  return sum;
+}
+
+// The sleep the benchmarks used to overlap with, kept for comparison.
+inline double sleep_kernel(useconds_t usec) {
+  usleep(usec);
+  return 0;
+}
+
+// What the -k option of AsynBcast and the MPI baseline runs: a sleep, the
+// triad or the DGEMM, with its working set allocated once up front. Pass it
+// to a thread with std::ref. consume needs a broadcast_data's flags, which
+// those drivers do not have, so it cannot be one.
+struct overlap_kernel {
+  compute_kernel kind;
+  triad_kernel triad;
+  dgemm_kernel dgemm;
+  useconds_t sleep_usec;
+
+  overlap_kernel(compute_kernel kind, size_t triad_size, size_t dgemm_size, useconds_t sleep_usec)
+    : kind(kind), triad(kind == compute_kernel::triad ? triad_size : 0, 10),
+      dgemm(kind == compute_kernel::dgemm ? dgemm_size : 0, 32, 1), sleep_usec(sleep_usec) {}
+
+  // The single kernel `name` names, if it is one overlap_kernel can run.
+  static bool parse(const char* name, compute_kernel& kind) {
+    std::vector<compute_kernel> kernels = parse_compute_kernels(name);
+    if (kernels.size() != 1 || kernels[0] == compute_kernel::consume)
+      return false;
+    kind = kernels[0];
+    return true;
+  }
+
+  void operator()() {
+    switch (kind) {
+      case compute_kernel::triad: triad.run(); break;
+      case compute_kernel::dgemm: dgemm.run(); break;
+      default: sleep_kernel(sleep_usec); break;
+    }
+  }
+};
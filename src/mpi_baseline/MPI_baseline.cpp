@@ -1,54 +1,132 @@
 #include <mpi.h>
 #include <chrono>
+#include <functional>
 #include <cstdio>
 #include <cassert>
+#include <string>
+#include <thread>
 #include <vector>
 #include <unistd.h>
 #include <string.h>
 
-int find_arg_idx(int argc, char** argv, const char* option) {
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], option) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-bool find_int_arg(int argc, char** argv, const char* option, bool default_value) {
-    int iplace = find_arg_idx(argc, argv, option);
-
-    if (iplace >= 0 && iplace < argc) {
-        return true;
-    }
-
-    return default_value;
-}
+#include "bench_args.hpp"
+#include "compute_kernels.hpp"
+#include "rma_broadcast.hpp"
 
 int main(int argc, char** argv) {
   bool kernel = find_int_arg(argc, argv, "-k", false);
-  int num_procs, rank;
-  MPI_Init(&argc, &argv);
+  // What -k runs: sleep, triad or dgemm (see compute_kernels.hpp), and
+  // its size: microseconds, triad doubles or DGEMM dimension.
+  char* kernel_name = find_string_arg(argc, argv, "-kernel", (char*) "sleep");
+  size_t sleep_usec = find_size_arg(argc, argv, "-sleep", 500000);
+  size_t triad_size = find_size_arg(argc, argv, "-triad", 1 << 21);
+  size_t dgemm_size = find_size_arg(argc, argv, "-dgemm", 256);
+  size_t bcast_size = find_size_arg(argc, argv, "-n", 1000000);
+  // bcast:  blocking MPI_Bcast, then the kernel.
+  // ibcast: MPI_Ibcast with the kernel running until MPI_Wait.
+  // flat, mst, async: the UPC++ algorithms over MPI RMA windows; async
+  //         forwards down `-tree` while the kernel runs, like AsynBcast.
+  std::string mode = find_string_arg(argc, argv, "-m", (char*) "bcast");
+  char* tree_name = find_string_arg(argc, argv, "-tree", (char*) "binary_split");
+  size_t radix = find_size_arg(argc, argv, "-radix", 2);
+  bcast_tree tree;
+  tree.radix = radix;
+  if (!parse_tree_shape(tree_name, tree.shape)) {
+    fprintf(stderr, "Unknown tree shape %s\n", tree_name);
+    return 1;
+  }
+  if (mode != "bcast" && mode != "ibcast" && mode != "flat" && mode != "mst" && mode != "async") {
+    fprintf(stderr, "Unknown mode %s\n", mode.c_str());
+    return 1;
+  }
+  compute_kernel kernel_kind;
+  if (!overlap_kernel::parse(kernel_name, kernel_kind)) {
+    fprintf(stderr, "-kernel must be one of sleep, triad or dgemm, not %s\n", kernel_name);
+    return 1;
+  }
+  int num_procs, rank, provided;
+  // The ibcast and async modes run the kernel on a second thread while
+  // this one keeps making the MPI calls.
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  if (provided < MPI_THREAD_FUNNELED) {
+    fprintf(stderr, "MPI does not support MPI_THREAD_FUNNELED\n");
+    MPI_Finalize();
+    return 1;
+  }
   MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  size_t bcast_size = 1000000;
-  std::vector<int> data(bcast_size, 0);
-  if (rank == 0) {
-    for(int i = 0; i < data.size(); i ++){
-        data[i] = 12;
-    }
-  }
+  if (rank == 0)
+    printf("==============MPI Bcast (%s)==============\n", mode.c_str());
 
-  auto begin = std::chrono::high_resolution_clock::now();
+  overlap_kernel run_kernel(kernel_kind, triad_size, dgemm_size, (useconds_t) sleep_usec);
 
-  MPI_Bcast(data.data(), bcast_size, MPI_INT, 0, MPI_COMM_WORLD);
-  auto end = std::chrono::high_resolution_clock::now();
-  double duration_data = std::chrono::duration<double>(end - begin).count();
+  std::vector<int> data(bcast_size, rank == 0 ? 12 : 0);
+  rma_broadcast<int>* rma = nullptr;
+  if (mode == "flat" || mode == "mst" || mode == "async") {
+    rma = new rma_broadcast<int>(bcast_size);
+    rma->tree = tree;
+    rma->init_root(data, 0);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
 
+  auto begin = std::chrono::high_resolution_clock::now();
+  auto end = begin;
+  double duration_data = 0;
+  double duration_put = 0;
   double duration_kernel = 0;
-  if (kernel){
-    usleep(500000);
+  std::thread worker;
+
+  if (mode == "bcast") {
+    MPI_Bcast(data.data(), bcast_size, MPI_INT, 0, MPI_COMM_WORLD);
+    end = std::chrono::high_resolution_clock::now();
+    duration_data = duration_put = std::chrono::duration<double>(end - begin).count();
+    if (kernel) {
+      run_kernel();
+      end = std::chrono::high_resolution_clock::now();
+      duration_kernel = std::chrono::duration<double>(end - begin).count();
+    }
+  } else if (mode == "ibcast") {
+    // Only the main thread calls MPI; MPI_Wait drives the broadcast while
+    // the kernel runs beside it. Data and forwarding finish together.
+    MPI_Request request;
+    MPI_Ibcast(data.data(), bcast_size, MPI_INT, 0, MPI_COMM_WORLD, &request);
+    if (kernel)
+      worker = std::thread(std::ref(run_kernel));
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    end = std::chrono::high_resolution_clock::now();
+    duration_data = duration_put = std::chrono::duration<double>(end - begin).count();
+  } else if (mode == "async") {
+    rma->ibcast(0);
+    while (!rma->test_data()) {
+    }
+    end = std::chrono::high_resolution_clock::now();
+    duration_data = std::chrono::duration<double>(end - begin).count();
+    if (kernel)
+      worker = std::thread(std::ref(run_kernel));
+    while (!rma->test()) {
+    }
+    end = std::chrono::high_resolution_clock::now();
+    duration_put = std::chrono::duration<double>(end - begin).count();
+  } else {
+    if (mode == "flat")
+      rma->broadcast_flat(0);
+    else
+      rma->broadcast_MST(0);
+    end = std::chrono::high_resolution_clock::now();
+    duration_put = std::chrono::duration<double>(end - begin).count();
+    while (!rma->check_ready()) {
+    }
+    end = std::chrono::high_resolution_clock::now();
+    duration_data = std::chrono::duration<double>(end - begin).count();
+    if (kernel) {
+      run_kernel();
+      end = std::chrono::high_resolution_clock::now();
+      duration_kernel = std::chrono::duration<double>(end - begin).count();
+    }
+  }
+  if (worker.joinable()) {
+    worker.join();
     end = std::chrono::high_resolution_clock::now();
     duration_kernel = std::chrono::duration<double>(end - begin).count();
   }
@@ -56,6 +134,8 @@ int main(int argc, char** argv) {
   MPI_Barrier(MPI_COMM_WORLD);
   double total_duration_data = 0;
   MPI_Reduce(&duration_data, &total_duration_data, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  double total_duration_put = 0;
+  MPI_Reduce(&duration_put, &total_duration_put, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
   double total_duration_kernel = 0;
   MPI_Reduce(&duration_kernel, &total_duration_kernel, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
 
@@ -65,11 +145,15 @@ int main(int argc, char** argv) {
     printf("(1) \t Data received in \t %lf \t seconds in average.\n", total_duration_data / num_procs);
     printf("(2) \t Kernel done in \t %lf \t seconds in average.\n", total_duration_kernel / num_procs);
     printf("(3) Broadcast took \t %lf \t seconds.\n", duration);
+    printf("(4) \t All work finished in \t %lf \t seconds in average.\n", total_duration_put / num_procs);
   }
-  
+
+  const int* result = rma ? rma->my_data() : data.data();
   for (size_t i = 0; i < bcast_size; i++) {
-    assert(data[i] == 12);
+    assert(result[i] == 12);
   }
 
+  delete rma;
+  MPI_Finalize();
   return 0;
 }
@@ -0,0 +1,117 @@
+#include <mpi.h>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include "bench_args.hpp"
+#include "bench_stats.hpp"
+
+// Time `iterations` MPI_Bcast calls of `bytes` from `root` after `warmup`
+// untimed ones. Each sample is the slowest rank's time from the barrier to
+// the return of its MPI_Bcast; only rank 0 gets them.
+std::vector<double> time_broadcasts(size_t bytes, int root, size_t warmup, size_t iterations) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    std::vector<char> data(bytes, rank == root ? 12 : 0);
+    std::vector<double> samples;
+    for (size_t it = 0; it < warmup + iterations; it++) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        double begin = MPI_Wtime();
+        MPI_Bcast(data.data(), (int) bytes, MPI_CHAR, root, MPI_COMM_WORLD);
+        double t = MPI_Wtime() - begin;
+        double slowest = 0;
+        MPI_Reduce(&t, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (it >= warmup)
+            samples.push_back(slowest);
+    }
+    assert(data[bytes - 1] == 12);
+    return samples;
+}
+
+// Time `iterations` MPI_Allreduce calls over `count` doubles with `op`, as
+// time_broadcasts does; compare with ReduceBench.
+std::vector<double> time_allreduces(size_t count, MPI_Op op, size_t warmup, size_t iterations) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    std::vector<double> input(count), output(count);
+    for (size_t i = 0; i < count; i++)
+        input[i] = (double) ((rank + i) % 5 + 1);
+    std::vector<double> samples;
+    for (size_t it = 0; it < warmup + iterations; it++) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        double begin = MPI_Wtime();
+        MPI_Allreduce(input.data(), output.data(), (int) count, MPI_DOUBLE, op, MPI_COMM_WORLD);
+        double t = MPI_Wtime() - begin;
+        double slowest = 0;
+        MPI_Reduce(&t, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (it >= warmup)
+            samples.push_back(slowest);
+    }
+    return samples;
+}
+
+int main(int argc, char** argv) {
+  size_t min_bytes = find_size_arg(argc, argv, "-min", 8);
+  size_t max_bytes = find_size_arg(argc, argv, "-max", 64 << 20);
+  size_t warmup = find_size_arg(argc, argv, "-w", 2);
+  size_t iterations = find_size_arg(argc, argv, "-i", 10);
+  // Number of roots to try, spread evenly over the ranks.
+  size_t n_roots = find_size_arg(argc, argv, "-r", 1);
+  // CSV is appended to, so runs at several rank counts share one file.
+  char* csv_file = find_string_arg(argc, argv, "-csv", nullptr);
+  char* json_file = find_string_arg(argc, argv, "-json", nullptr);
+  // Time MPI_Allreduce on doubles (sum, min or max) instead of MPI_Bcast.
+  bool allreduce = find_int_arg(argc, argv, "-allreduce", false);
+  std::string op_name = find_string_arg(argc, argv, "-op", (char*) "sum");
+  MPI_Op op = (op_name == "min") ? MPI_MIN : (op_name == "max") ? MPI_MAX : MPI_SUM;
+  int num_procs, rank;
+  MPI_Init(&argc, &argv);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  size_t p = num_procs;
+  n_roots = std::max<size_t>(1, std::min(n_roots, p));
+  std::vector<bench_result> results;
+
+  if (rank == 0) {
+    if (allreduce)
+      printf("=========MPI Allreduce Benchmark (%s)=========\n", op_name.c_str());
+    else
+      printf("=============MPI Bcast Benchmark=============\n");
+    print_header();
+  }
+
+  if (allreduce) {
+    for (size_t bytes : bench_sizes(std::max(min_bytes, sizeof(double)), max_bytes)) {
+      size_t count = bytes / sizeof(double);
+      std::vector<double> samples = time_allreduces(count, op, warmup, iterations);
+      if (rank == 0) {
+        results.push_back(summarize("mpi", "MPI_Allreduce", count * sizeof(double), num_procs, 0, samples));
+        print_result(results.back());
+      }
+    }
+  } else {
+    for (size_t bytes : bench_sizes(min_bytes, max_bytes)) {
+      for (size_t i = 0; i < n_roots; i++) {
+        int root = i * p / n_roots;
+        std::vector<double> samples = time_broadcasts(bytes, root, warmup, iterations);
+        if (rank == 0) {
+          results.push_back(summarize("mpi", "MPI_Bcast", bytes, num_procs, root, samples));
+          print_result(results.back());
+        }
+      }
+    }
+  }
+
+  if (rank == 0) {
+    if (csv_file != nullptr && !write_csv(csv_file, results))
+      fprintf(stderr, "Could not write %s\n", csv_file);
+    if (json_file != nullptr && !write_json(json_file, results))
+      fprintf(stderr, "Could not write %s\n", json_file);
+  }
+
+  MPI_Finalize();
+  return 0;
+}
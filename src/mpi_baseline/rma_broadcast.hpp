@@ -0,0 +1,199 @@
+#pragma once
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "tree.hpp"
+
+// MPI-3 RMA counterpart of broadcast_data, so the UPC++ broadcasts can be
+// compared against the same algorithms on MPI rather than only against
+// MPI_Bcast. Each rank exposes its buffer in one window and two flag words
+// in another: the last epoch whose data has arrived, and the last epoch it
+// has opened (is prepared to receive). Both windows stay in a lock_all
+// access epoch for the handle's lifetime.
+//
+// A put is MPI_Put of the payload, MPI_Win_flush to make it complete at
+// the target, then an MPI_Accumulate(MPI_REPLACE) of the epoch into the
+// target's arrival flag. Flags are read with MPI_Fetch_and_op(MPI_NO_OP),
+// which also drives the MPI progress engine while polling.
+template <typename T>
+struct rma_broadcast {
+  static constexpr int arrived_word = 0;
+  static constexpr int opened_word = 1;
+
+  rma_broadcast(size_t n, MPI_Comm comm = MPI_COMM_WORLD)
+    : bcast_size(n), comm(comm) {
+    MPI_Comm_rank(comm, &me);
+    MPI_Comm_size(comm, &n_ranks);
+    MPI_Win_allocate(n * sizeof(T), sizeof(T), MPI_INFO_NULL, comm, &data, &data_win);
+    MPI_Win_allocate(2 * sizeof(uint64_t), sizeof(uint64_t), MPI_INFO_NULL, comm, &flags, &flag_win);
+    flags[arrived_word] = 0;
+    flags[opened_word] = 0;
+    opened.assign(n_ranks, 0);
+    tree.shape = tree_shape::binary_split;
+    MPI_Win_lock_all(0, data_win);
+    MPI_Win_lock_all(0, flag_win);
+    MPI_Barrier(comm);
+  }
+
+  // Collective: no rank may still be putting to this one.
+  ~rma_broadcast() {
+    MPI_Win_unlock_all(flag_win);
+    MPI_Win_unlock_all(data_win);
+    MPI_Win_free(&flag_win);
+    MPI_Win_free(&data_win);
+  }
+
+  uint64_t read_flag(int rank, int word) {
+    uint64_t value = 0;
+    MPI_Fetch_and_op(nullptr, &value, MPI_UINT64_T, rank, word, MPI_NO_OP, flag_win);
+    MPI_Win_flush(rank, flag_win);
+    return value;
+  }
+
+  void write_flag(int rank, int word, uint64_t value) {
+    MPI_Accumulate(&value, 1, MPI_UINT64_T, rank, word, 1, MPI_UINT64_T, MPI_REPLACE, flag_win);
+    MPI_Win_flush(rank, flag_win);
+  }
+
+  // Start the next broadcast: wait for the previous one's data, then tell
+  // senders this rank may be overwritten.
+  void open_epoch() {
+    while (!check_ready()) {
+    }
+    epoch++;
+    write_flag(me, opened_word, epoch);
+  }
+
+  // Stage `values` on `root` for the next broadcast.
+  void init_root(const std::vector<T>& values, int root) {
+    if (me != root)
+      return;
+    // Nobody reads this buffer before the root opens the next epoch.
+    std::copy(values.begin(), values.end(), data);
+    MPI_Win_sync(data_win);
+    write_flag(me, arrived_word, epoch + 1);
+  }
+
+  bool check_ready() {
+    if (read_flag(me, arrived_word) < epoch)
+      return false;
+    // Make the puts that landed before the flag visible to local loads.
+    MPI_Win_sync(data_win);
+    return true;
+  }
+
+  // Block until `dest` has opened the current epoch.
+  void wait_receiver(int dest) {
+    while (opened[dest] < epoch)
+      opened[dest] = read_flag(dest, opened_word);
+  }
+
+  void put_to(int dest) {
+    wait_receiver(dest);
+    MPI_Put(data, (int) (bcast_size * sizeof(T)), MPI_BYTE, dest, 0,
+            (int) (bcast_size * sizeof(T)), MPI_BYTE, data_win);
+    MPI_Win_flush(dest, data_win);
+    write_flag(dest, arrived_word, epoch);
+  }
+
+  // Root puts its buffer straight to every other rank, all payloads in
+  // flight at once before the flags follow.
+  void broadcast_flat(int root) {
+    open_epoch();
+    if (me != root)
+      return;
+    while (!check_ready()) {
+    }
+    for (int dest = 0; dest < n_ranks; dest++) {
+      if (dest == root)
+        continue;
+      wait_receiver(dest);
+      MPI_Put(data, (int) (bcast_size * sizeof(T)), MPI_BYTE, dest, 0,
+              (int) (bcast_size * sizeof(T)), MPI_BYTE, data_win);
+    }
+    MPI_Win_flush_all(data_win);
+    for (int dest = 0; dest < n_ranks; dest++) {
+      if (dest != root)
+        write_flag(dest, arrived_word, epoch);
+    }
+  }
+
+  // Same recursion as broadcast_data::broadcast_MST.
+  void broadcast_MST(int root) {
+    open_epoch();
+    broadcast_MST(root, 0, n_ranks - 1);
+  }
+
+  void broadcast_MST(int root, int left, int right) {
+    if (left == right)
+      return;
+    int mid = left + (right - left) / 2;
+    int dest = (root <= mid) ? right : left;
+
+    if (me == root) {
+      while (!check_ready()) {
+      }
+      put_to(dest);
+    }
+
+    if (me <= mid && root <= mid)
+      broadcast_MST(root, left, mid);
+    else if (me <= mid && root > mid)
+      broadcast_MST(dest, left, mid);
+    else if (me > mid && root <= mid)
+      broadcast_MST(dest, mid + 1, right);
+    else
+      broadcast_MST(root, mid + 1, right);
+  }
+
+  // Asynchronous forwarding down `tree`, like async_broadcast::ibcast:
+  // post, then call test() until it returns true. Once the data is here
+  // each test() forwards it to the next child.
+  void ibcast(int root) {
+    open_epoch();
+    children.clear();
+    for (const auto& round : tree.rounds(root, me, n_ranks))
+      children.insert(children.end(), round.begin(), round.end());
+    next_child = 0;
+    data_seen = false;
+  }
+
+  // True once the data is here; test() keeps forwarding after that.
+  bool test_data() {
+    if (!data_seen)
+      data_seen = check_ready();
+    return data_seen;
+  }
+
+  bool test() {
+    if (!test_data())
+      return false;
+    if (next_child < children.size())
+      put_to((int) children[next_child++]);
+    return next_child == children.size();
+  }
+
+  T* my_data() {
+    return data;
+  }
+
+  size_t bcast_size;
+  MPI_Comm comm;
+  int me, n_ranks;
+  // Current broadcast number; the same on every rank.
+  uint64_t epoch = 0;
+  T* data;
+  uint64_t* flags;
+  MPI_Win data_win, flag_win;
+  // Last epoch each rank was seen to have opened.
+  std::vector<uint64_t> opened;
+  // Shape and radix for ibcast.
+  bcast_tree tree;
+  std::vector<size_t> children;
+  size_t next_child = 0;
+  bool data_seen = false;
+};
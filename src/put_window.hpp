@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+// Sender-side flow control: bounds the puts a rank has in flight, by count
+// and by bytes, so a root fanning out to many ranks keeps the NIC busy
+// without queueing more than it can inject. Before a put, acquire() (or
+// try_acquire() where blocking is not allowed) makes room; track() then
+// counts the put until its future is ready. Completions are reaped in
+// batches: only once the window is full, and then all of them in one pass
+// instead of one future per put. A put larger than max_bytes still goes
+// out, alone.
+struct put_window {
+  // Limits on puts in flight; 0 means no limit.
+  size_t max_ops, max_bytes;
+
+  put_window(size_t max_ops = 64, size_t max_bytes = 16 << 20)
+    : max_ops(max_ops), max_bytes(max_bytes) {}
+
+  bool fits(size_t bytes) const {
+    if (in_flight.empty())
+      return true;
+    return (max_ops == 0 || in_flight.size() < max_ops) &&
+           (max_bytes == 0 || bytes_in_flight + bytes <= max_bytes);
+  }
+
+  // Make room for a put of `bytes` if the completed puts leave enough.
+  bool try_acquire(size_t bytes) {
+    if (fits(bytes))
+      return true;
+    reap();
+    return fits(bytes);
+  }
+
+  // Block until a put of `bytes` fits.
+  void acquire(size_t bytes) {
+    if (try_acquire(bytes))
+      return;
+    stalls++;
+    do {
+      upcxx::progress();
+    } while (!try_acquire(bytes));
+  }
+
+  // Count `done`, a put of `bytes`, until it is ready; returns it.
+  upcxx::future<> track(upcxx::future<> done, size_t bytes) {
+    if (!done.ready()) {
+      in_flight.push_back(std::make_pair(done, bytes));
+      bytes_in_flight += bytes;
+    }
+    return done;
+  }
+
+  // Forget every put that has completed.
+  void reap() {
+    auto live = std::remove_if(in_flight.begin(), in_flight.end(),
+      [this](const std::pair<upcxx::future<>, size_t>& put){
+        if (!put.first.ready())
+          return false;
+        bytes_in_flight -= put.second;
+        return true;
+      });
+    in_flight.erase(live, in_flight.end());
+  }
+
+  // Block until every tracked put has completed.
+  void drain() {
+    while (!in_flight.empty()) {
+      upcxx::progress();
+      reap();
+    }
+  }
+
+  std::vector<std::pair<upcxx::future<>, size_t>> in_flight;
+  size_t bytes_in_flight = 0;
+  // Number of times acquire() had to wait for room.
+  size_t stalls = 0;
+};
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+#include "combine_kernels.hpp"
+#include "segment_arena.hpp"
+
+// Recursive doubling sends the whole vector at every step, so it needs a
+// receive slot per step; buffers larger than this (in bytes) do not get
+// them and always take Rabenseifner's algorithm.
+constexpr size_t rd_buffer_limit = 65536;
+
+// Recursive doubling: log2(P) exchanges of the whole vector, for small
+//                     vectors where latency dominates.
+// Rabenseifner:       reduce-scatter by recursive halving, then allgather by
+//                     recursive doubling (or a gather to the root for a
+//                     rooted reduce), so each rank moves about 2n elements.
+enum class reduce_algorithm { recursive_doubling, rabenseifner };
+
+inline const char* reduce_algorithm_name(reduce_algorithm alg) {
+  switch (alg) {
+    case reduce_algorithm::recursive_doubling: return "recursive_doubling";
+    case reduce_algorithm::rabenseifner: return "rabenseifner";
+  }
+  return "unknown";
+}
+
+template <typename T>
+struct reduce_request;
+
+// A persistent reduce/allreduce handle over the ranks of a team, built like
+// broadcast_data: every rank publishes its buffers in a dist_object, data
+// moves with one-sided puts, and each put sets a flag at the target from
+// an RPC riding on its remote completion. Reduction number e (the epoch)
+// has arrived at a step once that step's flag reads e.
+//
+// Every rank fills my_data() with its input and posts the same reductions
+// in the same order; the result replaces the input in place. Non-power-of-
+// two rank counts fold the extra ranks into partners first. Received data
+// lands in scratch slots that alternate by epoch parity, and a reduction
+// is only posted once this rank's previous one is complete, so a rank can
+// never get two epochs ahead of another's slots.
+template <typename T>
+struct reduce_data {
+  struct peer {
+    // Global pointer to the data buffer (input, then result).
+    upcxx::global_ptr<T> data;
+    // Global pointer to both parities of receive slots.
+    upcxx::global_ptr<T> scratch;
+    // Global pointer to the per-step arrival flags.
+    upcxx::global_ptr<uint64_t> flags;
+  };
+
+  // One step of this rank's schedule. A put sends `count` elements of
+  // data from `offset` to `dest` (into its scratch or data at
+  // `dest_offset`) and sets flag `dest_flag` there; with no elements it
+  // just sets the flag. A receive waits for flag `flag` and then folds (or
+  // copies) `count` elements of scratch from `scratch_offset` into data at
+  // `offset`.
+  struct step {
+    bool is_put;
+    size_t offset, count;
+    size_t dest, dest_offset, dest_flag;
+    bool to_scratch;
+    // The put reads data that is folded into right after, so the source
+    // is buffered at injection.
+    bool buffered;
+    size_t flag, scratch_offset;
+    bool fold;
+  };
+
+  // State of the reduction in flight on this rank.
+  struct reduction {
+    uint64_t epoch;
+    std::vector<step> steps;
+    size_t next_step = 0;
+    // Fulfilled once the result is in my_data() (or this rank's part is done).
+    upcxx::promise<> arrived;
+    // Completion counter for the puts, finalized once all are issued.
+    upcxx::promise<> sent;
+    upcxx::future<> sent_done;
+    upcxx::promise<> completed;
+    bool arrived_seen = false;
+    bool finished = false;
+  };
+
+  // `n` elements per rank. A non-null `buffer` (local, at least `n`
+  // elements) holds the input and result instead of one allocated here.
+  reduce_data(size_t n, upcxx::global_ptr<T> buffer = nullptr, upcxx::team& team = upcxx::world())
+    : count(n), tm(&team), user_buffer(buffer), mine(allocate(), team) {
+    peers.emplace(tm->rank_me(), *mine);
+  }
+
+  // Lay out and allocate this rank's buffers from collective_arena(),
+  // fully built before they are published.
+  peer allocate() {
+    size_t p = tm->rank_n();
+    p2 = 1;
+    levels = 0;
+    while (p2 * 2 <= p) {
+      p2 *= 2;
+      levels++;
+    }
+    rd_slots = (count * sizeof(T) <= rd_buffer_limit) ? levels : 0;
+    // Halving step s receives p2 >> (s + 1) blocks of at most ceil(n / p2).
+    size_t block = (count + p2 - 1) / p2;
+    rs_offsets.assign(levels + 1, count);
+    for (size_t s = 0; s < levels; s++)
+      rs_offsets[s + 1] = rs_offsets[s] + block * (p2 >> (s + 1));
+    // Slot 0 (n elements) takes a folded-in extra rank's vector and,
+    // later, the blocks a rooted reduce gathers.
+    slot_size = count + std::max(rd_slots * count, rs_offsets[levels] - count);
+
+    segment_arena& arena = collective_arena();
+    peer me;
+    me.data = user_buffer ? user_buffer : arena.allocate<T>(count);
+    me.scratch = arena.allocate<T>(2 * slot_size);
+    me.flags = arena.allocate_filled<uint64_t>(n_flags(), 0);
+    return me;
+  }
+
+  // Collective: no rank may still be putting to this one.
+  ~reduce_data() {
+    if (!upcxx::initialized())
+      return;
+    segment_arena& arena = collective_arena();
+    if (!user_buffer)
+      arena.deallocate(mine->data, count);
+    arena.deallocate(mine->scratch, 2 * slot_size);
+    arena.deallocate(mine->flags, n_flags());
+  }
+
+  const peer& resolve(size_t r) {
+    auto it = peers.find(r);
+    if (it == peers.end())
+      it = peers.emplace(r, mine.fetch(r).wait()).first;
+    return it->second;
+  }
+
+  // Flags: the folded-in extra rank, one per halving or doubling step, one
+  // per allgather step, the result sent back to the extra rank, and one
+  // per block gathered at a root.
+  size_t pre_flag() const { return 0; }
+  size_t step_flag(size_t s) const { return 1 + s; }
+  size_t allgather_flag(size_t t) const { return 1 + levels + t; }
+  size_t post_flag() const { return 1 + 2 * levels; }
+  size_t gather_flag(size_t b) const { return 2 + 2 * levels + b; }
+  size_t n_flags() const { return 2 + 2 * levels + p2; }
+
+  // Elements [block_begin(b), block_begin(b + 1)) form block b of p2.
+  size_t block_begin(size_t b) const {
+    return b * count / p2;
+  }
+
+  // Algorithm for an unspecified reduction: recursive doubling up to
+  // `rd_threshold` bytes, where it has slots, and Rabenseifner above.
+  reduce_algorithm pick() const {
+    if (rd_slots > 0 && count * sizeof(T) <= rd_threshold)
+      return reduce_algorithm::recursive_doubling;
+    return reduce_algorithm::rabenseifner;
+  }
+
+  // Allreduce my_data() over the team with `op`.
+  reduce_request<T> iallreduce(reduce_op op) {
+    return post(op, pick(), SIZE_MAX);
+  }
+
+  reduce_request<T> iallreduce(reduce_op op, reduce_algorithm alg) {
+    return post(op, alg, SIZE_MAX);
+  }
+
+  // Reduce my_data() into `root`'s my_data(); the other ranks' buffers are
+  // left with partial results. Small reductions run as an allreduce, which
+  // at that size costs the same number of steps.
+  reduce_request<T> ireduce(reduce_op op, size_t root) {
+    return post(op, pick(), root);
+  }
+
+  reduce_request<T> ireduce(reduce_op op, reduce_algorithm alg, size_t root) {
+    return post(op, alg, root);
+  }
+
+  reduce_request<T> post(reduce_op op, reduce_algorithm alg, size_t root) {
+    if (current)
+      reduce_request<T>{this}.wait();
+    if (alg == reduce_algorithm::recursive_doubling && rd_slots == 0)
+      alg = reduce_algorithm::rabenseifner;
+    if (alg == reduce_algorithm::recursive_doubling)
+      root = SIZE_MAX;
+
+    epoch++;
+    current.reset(new reduction);
+    current->epoch = epoch;
+    reduce_kind = op;
+    size_t base = (epoch % 2) * slot_size;
+    size_t p = tm->rank_n();
+    size_t origin = (root == SIZE_MAX) ? 0 : root;
+    size_t rel = (tm->rank_me() + p - origin) % p;
+    std::vector<step>& steps = current->steps;
+    auto rank_of = [&](size_t r){ return (r + origin) % p; };
+
+    // Extra ranks hand their vector to a partner and wait for the result,
+    // or in a rooted reduce just for the partner to have folded it in.
+    if (rel >= p2) {
+      steps.push_back(put_step(0, count, rank_of(rel - p2), true, base, pre_flag()));
+      steps.push_back(recv_step(post_flag(), SIZE_MAX, 0, 0, false));
+      return start();
+    }
+    if (rel + p2 < p) {
+      steps.push_back(recv_step(pre_flag(), base, 0, count, true));
+      if (root != SIZE_MAX)
+        steps.push_back(put_step(0, 0, rank_of(rel + p2), false, 0, post_flag()));
+    }
+
+    if (alg == reduce_algorithm::recursive_doubling) {
+      for (size_t s = 0; s < levels; s++) {
+        size_t partner = rank_of(rel ^ (size_t(1) << s));
+        steps.push_back(put_step(0, count, partner, true, base + count * (1 + s), step_flag(s)));
+        steps.back().buffered = true;
+        steps.push_back(recv_step(step_flag(s), base + count * (1 + s), 0, count, true));
+      }
+    } else {
+      // Reduce-scatter: keep half of the blocks, send the other half.
+      size_t lo = 0, hi = p2;
+      for (size_t s = 0; s < levels; s++) {
+        size_t mask = p2 >> (s + 1);
+        size_t partner = rank_of(rel ^ mask);
+        size_t mid = lo + (hi - lo) / 2;
+        size_t send_lo = (rel & mask) ? lo : mid;
+        size_t send_hi = (rel & mask) ? mid : hi;
+        lo = (rel & mask) ? mid : lo;
+        hi = (rel & mask) ? hi : mid;
+        size_t slot = base + rs_offsets[s];
+        steps.push_back(put_step(block_begin(send_lo), block_begin(send_hi) - block_begin(send_lo),
+                                 partner, true, slot, step_flag(s)));
+        steps.push_back(recv_step(step_flag(s), slot, block_begin(lo),
+                                  block_begin(hi) - block_begin(lo), true));
+      }
+
+      if (root == SIZE_MAX) {
+        // Allgather: exchange ever larger finished ranges straight into the
+        // partner's data. Whatever lands there is exactly what this rank
+        // sent the partner while halving, so it has already been read.
+        for (size_t t = 0; t < levels; t++) {
+          size_t mask = size_t(1) << t;
+          size_t partner = rank_of(rel ^ mask);
+          size_t width = hi - lo;
+          size_t other_lo = (rel & mask) ? lo - width : hi;
+          steps.push_back(put_step(block_begin(lo), block_begin(hi) - block_begin(lo),
+                                   partner, false, block_begin(lo), allgather_flag(t)));
+          steps.push_back(recv_step(allgather_flag(t), SIZE_MAX, block_begin(other_lo),
+                                    block_begin(other_lo + width) - block_begin(other_lo), false));
+          lo = std::min(lo, other_lo);
+          hi = lo + 2 * width;
+        }
+      } else if (rel == 0) {
+        // Gather: every other block lands in slot 0 and is copied over.
+        for (size_t b = 1; b < p2; b++) {
+          steps.push_back(recv_step(gather_flag(b), base + block_begin(b), block_begin(b),
+                                    block_begin(b + 1) - block_begin(b), false));
+        }
+      } else {
+        steps.push_back(put_step(block_begin(rel), block_begin(rel + 1) - block_begin(rel),
+                                 origin, true, base + block_begin(rel), gather_flag(rel)));
+      }
+    }
+
+    // Hand the result back to the folded-in extra rank.
+    if (root == SIZE_MAX && rel + p2 < p)
+      steps.push_back(put_step(0, count, rank_of(rel + p2), false, 0, post_flag()));
+    return start();
+  }
+
+  step put_step(size_t offset, size_t n, size_t dest, bool to_scratch, size_t dest_offset,
+                size_t dest_flag) {
+    step st = step();
+    st.is_put = true;
+    st.offset = offset;
+    st.count = n;
+    st.dest = dest;
+    st.to_scratch = to_scratch;
+    st.dest_offset = dest_offset;
+    st.dest_flag = dest_flag;
+    return st;
+  }
+
+  // A receive with scratch_offset SIZE_MAX only waits: the data was put
+  // straight into my_data().
+  step recv_step(size_t flag, size_t scratch_offset, size_t offset, size_t n, bool fold) {
+    step st = step();
+    st.is_put = false;
+    st.flag = flag;
+    st.scratch_offset = scratch_offset;
+    st.offset = offset;
+    st.count = n;
+    st.fold = fold;
+    return st;
+  }
+
+  reduce_request<T> start() {
+    reduce_request<T> request{this};
+    advance();
+    return request;
+  }
+
+  // Run the current reduction's steps as far as the arrived data allows.
+  // Returns true once its result is in and all of its puts have completed.
+  bool advance() {
+    reduction& o = *current;
+    if (o.finished)
+      return true;
+    upcxx::progress();
+    volatile uint64_t* flags = local_flags();
+    while (o.next_step < o.steps.size()) {
+      const step& st = o.steps[o.next_step];
+      if (st.is_put) {
+        put(o, st);
+      } else {
+        if (flags[st.flag] < o.epoch)
+          break;
+        const T* src = mine->scratch.local() + st.scratch_offset;
+        if (st.scratch_offset != SIZE_MAX && st.fold)
+          combine(reduce_kind, my_data() + st.offset, src, st.count);
+        else if (st.scratch_offset != SIZE_MAX)
+          std::copy(src, src + st.count, my_data() + st.offset);
+      }
+      o.next_step++;
+    }
+    if (!o.arrived_seen && o.next_step == o.steps.size()) {
+      o.sent_done = o.sent.finalize();
+      o.arrived_seen = true;
+      o.arrived.fulfill_anonymous(1);
+    }
+    if (o.arrived_seen && o.sent_done.ready()) {
+      o.finished = true;
+      o.completed.fulfill_anonymous(1);
+    }
+    return o.finished;
+  }
+
+  // Flags only ever move forward: the RPCs of two epochs may run out of order.
+  static void raise_flag(upcxx::global_ptr<uint64_t> flag, uint64_t e) {
+    uint64_t* f = flag.local();
+    *f = std::max(*f, e);
+  }
+
+  void put(reduction& o, const step& st) {
+    const peer& p = resolve(st.dest);
+    if (st.count == 0) {
+      upcxx::rpc_ff(*tm, st.dest, raise_flag, p.flags + st.dest_flag, o.epoch);
+      return;
+    }
+    upcxx::global_ptr<T> dst = (st.to_scratch ? p.scratch : p.data) + st.dest_offset;
+    auto signal = upcxx::remote_cx::as_rpc(raise_flag, p.flags + st.dest_flag, o.epoch);
+    if (st.buffered) {
+      upcxx::rput(my_data() + st.offset, dst, st.count,
+                  upcxx::source_cx::as_buffered() | upcxx::operation_cx::as_promise(o.sent) | signal);
+    } else {
+      upcxx::rput(my_data() + st.offset, dst, st.count,
+                  upcxx::operation_cx::as_promise(o.sent) | signal);
+    }
+  }
+
+  volatile uint64_t* local_flags() {
+    return mine->flags.local();
+  }
+
+  T* my_data() {
+    return mine->data.local();
+  }
+
+  size_t count;
+  upcxx::team* tm;
+  upcxx::global_ptr<T> user_buffer;
+  // Largest power of two not above the team size, and its log2.
+  size_t p2, levels;
+  // Recursive doubling slots (0 or levels), and where each halving step's
+  // slot starts within a parity's scratch.
+  size_t rd_slots;
+  std::vector<size_t> rs_offsets;
+  size_t slot_size;
+  // Largest reduction, in bytes, that pick() sends by recursive doubling.
+  size_t rd_threshold = 8192;
+  uint64_t epoch = 0;
+  reduce_op reduce_kind = reduce_op::sum;
+  std::unique_ptr<reduction> current;
+  // This rank's pointers, published for lazy lookup by the others.
+  upcxx::dist_object<peer> mine;
+  // Pointers of the ranks this process has talked to.
+  std::unordered_map<size_t, peer> peers;
+};
+
+// Handle to the reduction in flight on a reduce_data. Polling it with
+// test() or wait() advances it; result() becomes ready once this rank's
+// result is in my_data() (or, off the root, its part is done) and done()
+// once all of its puts have completed too.
+template <typename T>
+struct reduce_request {
+  reduce_data<T>* reduce;
+
+  bool test() {
+    return reduce->advance();
+  }
+
+  void wait() {
+    while (!test()) {
+    }
+  }
+
+  upcxx::future<> result() const {
+    return reduce->current->arrived.get_future();
+  }
+
+  upcxx::future<> done() const {
+    return reduce->current->completed.get_future();
+  }
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <upcxx/upcxx.hpp>
+
+// Cache-line-aligned blocks of this rank's shared segment for collective
+// buffers and flags. One region is reserved up front (by reserve(), or on
+// the first allocation) and carved into power-of-two size classes of at
+// least a cache line. A freed block goes on its class's free list and the
+// next allocation of that class takes it back, so creating a broadcast
+// per size or per iteration neither fragments the segment nor goes to the
+// allocator once warm. What the region cannot hold comes from
+// upcxx::allocate instead, aligned the same, and goes back to it on free.
+// Running out of shared segment either way is fatal, with a message.
+struct segment_arena {
+  static constexpr size_t line = 64;
+
+  explicit segment_arena(size_t capacity) : capacity(capacity - capacity % line) {}
+
+  ~segment_arena() {
+    if (base && upcxx::initialized())
+      upcxx::deallocate(base);
+  }
+
+  // Reserve the region now, off the critical path, with `bytes` instead
+  // of the default if it is not reserved yet.
+  void reserve(size_t bytes) {
+    if (!base) {
+      capacity = bytes - bytes % line;
+      reserve();
+    }
+  }
+
+  void reserve() {
+    if (!base && capacity > 0) {
+      base = upcxx::allocate<char, line>(capacity);
+      if (!base)
+        out_of_segment(capacity);
+    }
+  }
+
+  // Uninitialized room for `n` T's.
+  template <typename T>
+  upcxx::global_ptr<T> allocate(size_t n) {
+    size_t k = size_class(n * sizeof(T));
+    char* block = nullptr;
+    if (k < free_lists.size() && !free_lists[k].empty()) {
+      block = free_lists[k].back();
+      free_lists[k].pop_back();
+      reused++;
+    } else {
+      block = carve(size_t(1) << k);
+    }
+    if (!block) {
+      fallbacks++;
+      upcxx::global_ptr<T> p = upcxx::allocate<T, line>(std::max<size_t>(n, 1));
+      if (!p)
+        out_of_segment(n * sizeof(T));
+      return p;
+    }
+    return upcxx::to_global_ptr(reinterpret_cast<T*>(block));
+  }
+
+  // `n` T's, all set to `value`.
+  template <typename T>
+  upcxx::global_ptr<T> allocate_filled(size_t n, T value) {
+    upcxx::global_ptr<T> p = allocate<T>(n);
+    std::fill(p.local(), p.local() + n, value);
+    return p;
+  }
+
+  // Give back `p`, allocated here for `n` T's.
+  template <typename T>
+  void deallocate(upcxx::global_ptr<T> p, size_t n) {
+    if (!p)
+      return;
+    char* block = reinterpret_cast<char*>(p.local());
+    if (!owns(block)) {
+      upcxx::deallocate(p);
+      return;
+    }
+    size_t k = size_class(n * sizeof(T));
+    if (free_lists.size() <= k)
+      free_lists.resize(k + 1);
+    free_lists[k].push_back(block);
+  }
+
+  // upcxx::allocate returns null when the shared heap is exhausted.
+  static void out_of_segment(size_t bytes) {
+    fprintf(stderr, "Rank %d: could not allocate %zu bytes of shared segment; "
+            "raise UPCXX_SHARED_HEAP_SIZE\n", upcxx::rank_me(), bytes);
+    abort();
+  }
+
+  bool owns(const char* p) const {
+    return base && p >= base.local() && p < base.local() + capacity;
+  }
+
+  // log2 of the size of the blocks holding `bytes`.
+  static size_t size_class(size_t bytes) {
+    size_t k = 6;
+    while ((size_t(1) << k) < bytes)
+      k++;
+    return k;
+  }
+
+  // A fresh block from the region, or null once it is used up.
+  char* carve(size_t bytes) {
+    reserve();
+    if (used + bytes > capacity)
+      return nullptr;
+    char* block = base.local() + used;
+    used += bytes;
+    return block;
+  }
+
+  size_t capacity, used = 0;
+  upcxx::global_ptr<char> base;
+  // Free blocks by size class.
+  std::vector<std::vector<char*>> free_lists;
+  // Allocations served from a free list, and from outside the region.
+  size_t reused = 0, fallbacks = 0;
+};
+
+// The arena the collectives here allocate from, one per process.
+inline segment_arena& collective_arena() {
+  static segment_arena arena(16 << 20);
+  return arena;
+}
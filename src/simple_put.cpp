@@ -1,101 +1,44 @@
 #include <chrono>
 #include <cstdio>
 #include <cassert>
+#include <string>
 #include <unistd.h>
 
 #include <upcxx/upcxx.hpp>
 
-template <typename T>
-struct broadcast_data {
-  broadcast_data(size_t n) {
-    for (size_t i = 0; i < upcxx::rank_n(); i++) {
-      upcxx::global_ptr<T> ptr = nullptr;
-      if (upcxx::rank_me() == i) {
-        ptr = upcxx::new_array<T>(n);
-      }
-      ptr = upcxx::broadcast(ptr, i).wait();
-      data_ptrs.push_back(ptr);
-
-      upcxx::global_ptr<int> cptr = nullptr;
-      if (upcxx::rank_me() == i) {
-        cptr = upcxx::new_array<int>(1);
-        *cptr.local() = 0;
-      }
-      cptr = upcxx::broadcast(cptr, i).wait();
-      confirmation_ptrs.push_back(cptr);
-    }
-  }
-
-  // Broadcast vector `data` from process `root` to
-  // all other processes.
-  void broadcast_simple(const std::vector<T>& data, size_t root) {
-    if (upcxx::rank_me() == root) {
-      for (size_t i = 0; i < upcxx::rank_n(); i++) {
-        int flag = 1;
-        upcxx::rput(data.data(), data_ptrs[i], data.size()).wait();
-        upcxx::rput(&flag, confirmation_ptrs[i], 1).wait();
-      }
-    }
-  }
-
-  bool check_ready() {
-    if (upcxx::rget(confirmation_ptrs[upcxx::rank_me()]).wait() == 1) {
-      return true;
-    } else {
-      return false;
-    }
-  }
-
-  T* my_data() {
-    return data_ptrs[upcxx::rank_me()].local();
-  }
-
-  // Global pointers to data buffer for each process.
-  std::vector<upcxx::global_ptr<T>> data_ptrs;
-  // Global pointers to confirmation flag for each process.
-  std::vector<upcxx::global_ptr<int>> confirmation_ptrs;
-};
-
-int find_arg_idx(int argc, char** argv, const char* option) {
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], option) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-bool find_int_arg(int argc, char** argv, const char* option, bool default_value) {
-    int iplace = find_arg_idx(argc, argv, option);
-
-    if (iplace >= 0 && iplace < argc) {
-        return true;
-    }
-
-    return default_value;
-}
+#include "bench_args.hpp"
+#include "broadcast_data.hpp"
 
 int main(int argc, char** argv) {
 
   bool kernel = find_int_arg(argc, argv, "-k", false);
+  // Limits on the root's puts in flight, in puts and bytes (0: none).
+  size_t window_ops = find_size_arg(argc, argv, "-window", 64);
+  size_t window_bytes = find_size_arg(argc, argv, "-window-bytes", 16 << 20);
 
   upcxx::init();
 
   size_t bcast_size = 1000000;
 
   // Initialize a broadcast "data structure"
-  // to support broadcasts up to `bcast_size` ints.
+  // to support broadcasts up to `bcast_size` ints. The root puts to every
+  // rank in turn, each flag following its data put, with up to `window`'s
+  // limits of them in flight at once.
   
-  broadcast_data<int> bcast(bcast_size);
-
-  upcxx::barrier();
-  auto begin = std::chrono::high_resolution_clock::now();
+  broadcast_data<int, no_trace, put_signal> bcast(bcast_size);
+  bcast.window.max_ops = window_ops;
+  bcast.window.max_bytes = window_bytes;
 
   if (upcxx::rank_me() == 0) {
     std::vector<int> data(bcast_size, 12);
-    bcast.broadcast_simple(data, 0);
+    bcast.init_root(data, 0);
   }
 
+  upcxx::barrier();
+  auto begin = std::chrono::high_resolution_clock::now();
+
+  bcast.broadcast(bcast_algorithm::flat, 0).wait();
+
   while (!bcast.check_ready()) {
     
   }
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+// Shapes of the tree a broadcast travels down.
+//  binary_split: the original MST, halving the rank range at every level.
+//  knomial:      radix-k binomial tree; a forwarder sends to up to k-1
+//                children per round, for ceil(log_k P) rounds.
+//  kary:         heap-ordered k-ary tree; a forwarder sends to its k
+//                children in a single round.
+//  fibonacci:    greedy LogP schedule where a message takes `radix` send
+//                overheads to arrive (radix 1 is binomial, 2 Fibonacci).
+enum class tree_shape { binary_split, knomial, kary, fibonacci };
+
+inline const char* tree_shape_name(tree_shape shape) {
+  switch (shape) {
+    case tree_shape::binary_split: return "binary_split";
+    case tree_shape::knomial: return "knomial";
+    case tree_shape::kary: return "kary";
+    case tree_shape::fibonacci: return "fibonacci";
+  }
+  return "unknown";
+}
+
+inline bool parse_tree_shape(const char* name, tree_shape& shape) {
+  const tree_shape all[] = {tree_shape::binary_split, tree_shape::knomial,
+                            tree_shape::kary, tree_shape::fibonacci};
+  for (tree_shape s : all) {
+    if (strcmp(name, tree_shape_name(s)) == 0) {
+      shape = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct bcast_tree {
+  tree_shape shape = tree_shape::knomial;
+  size_t radix = 2;
+
+  bool operator==(const bcast_tree& other) const {
+    return shape == other.shape && radix == other.radix;
+  }
+
+  // Children of `me` when broadcasting from `root` over ranks [0, n),
+  // grouped into rounds: the puts of a round go out together, and a round
+  // starts once the previous one has completed.
+  std::vector<std::vector<size_t>> rounds(size_t root, size_t me, size_t n) const {
+    size_t k = (radix < 1) ? 1 : radix;
+    size_t rel = (me + n - root) % n;
+    std::vector<std::vector<size_t>> result;
+    switch (shape) {
+      case tree_shape::binary_split:
+        for (size_t child : mst_children(root, me, n))
+          result.push_back({child});
+        return result;
+      case tree_shape::knomial:
+        result = knomial_rounds(rel, n, (k < 2) ? 2 : k);
+        break;
+      case tree_shape::kary:
+        result.push_back(kary_children(rel, n, k));
+        break;
+      case tree_shape::fibonacci:
+        for (size_t child : fibonacci_children(rel, n, k))
+          result.push_back({child});
+        break;
+    }
+    // Back from ranks relative to the root.
+    for (auto& round : result) {
+      for (size_t& child : round)
+        child = (child + root) % n;
+    }
+    return result;
+  }
+
+  std::vector<size_t> children(size_t root, size_t me, size_t n) const {
+    std::vector<size_t> flat;
+    for (const auto& round : rounds(root, me, n))
+      flat.insert(flat.end(), round.begin(), round.end());
+    return flat;
+  }
+
+  // Parent of `me`, its parent and so on up to `root`; empty for the root.
+  // Only `me`'s own chain is walked, so this costs about the tree's depth
+  // (the fibonacci schedule is replayed once, up to `me`).
+  std::vector<size_t> ancestors(size_t root, size_t me, size_t n) const {
+    size_t k = (radix < 1) ? 1 : radix;
+    size_t rel = (me + n - root) % n;
+    std::vector<size_t> chain;
+    switch (shape) {
+      case tree_shape::binary_split:
+        for (size_t r = mst_parent(root, me, n); r != n; r = mst_parent(root, r, n))
+          chain.push_back(r);
+        return chain;
+      case tree_shape::knomial:
+        if (k < 2)
+          k = 2;
+        while (rel != 0) {
+          size_t span = 1;
+          while ((rel / span) % k == 0)
+            span *= k;
+          rel -= ((rel / span) % k) * span;
+          chain.push_back(rel);
+        }
+        break;
+      case tree_shape::kary:
+        while (rel != 0) {
+          rel = (rel - 1) / k;
+          chain.push_back(rel);
+        }
+        break;
+      case tree_shape::fibonacci: {
+        std::vector<size_t> parents = fibonacci_parents(rel, n, k);
+        while (rel != 0) {
+          rel = parents[rel];
+          chain.push_back(rel);
+        }
+        break;
+      }
+    }
+    for (size_t& r : chain)
+      r = (r + root) % n;
+    return chain;
+  }
+
+  // Parent of `me` in the MST from `root`, or n for the root itself.
+  static size_t mst_parent(size_t root, size_t me, size_t n) {
+    size_t left = 0;
+    size_t right = n - 1;
+    while (left != right) {
+      size_t mid = left + (right - left) / 2;
+      size_t dest = (root <= mid) ? right: left;
+      if (dest == me && root != me)
+        return root;
+
+      if (me <= mid) {
+        if (root > mid)
+          root = dest;
+        right = mid;
+      } else {
+        if (root <= mid)
+          root = dest;
+        left = mid + 1;
+      }
+    }
+    return n;
+  }
+
+  // Children of `me` in the MST over ranks [0, n) rooted at `root`, in the
+  // order broadcast_MST visits them (largest subtree first).
+  static std::vector<size_t> mst_children(size_t root, size_t me, size_t n) {
+    std::vector<size_t> children;
+    size_t left = 0;
+    size_t right = n - 1;
+    while (left != right) {
+      size_t mid = left + (right - left) / 2;
+      size_t dest = (root <= mid) ? right: left;
+      if (me == root)
+        children.push_back(dest);
+
+      if (me <= mid) {
+        if (root > mid)
+          root = dest;
+        right = mid;
+      } else {
+        if (root <= mid)
+          root = dest;
+        left = mid + 1;
+      }
+    }
+    return children;
+  }
+
+  // Relative rank `rel` owns the subtree below its lowest non-zero base-k
+  // digit; it hands out that range one digit position per round, largest
+  // first, to rel + j * k^i for j = 1 .. k-1.
+  static std::vector<std::vector<size_t>> knomial_rounds(size_t rel, size_t n, size_t k) {
+    size_t span = 1;
+    if (rel == 0) {
+      while (span < n)
+        span *= k;
+    } else {
+      while ((rel / span) % k == 0)
+        span *= k;
+    }
+    std::vector<std::vector<size_t>> rounds;
+    for (size_t place = span / k; place > 0; place /= k) {
+      std::vector<size_t> round;
+      for (size_t j = 1; j < k && rel + j * place < n; j++)
+        round.push_back(rel + j * place);
+      if (!round.empty())
+        rounds.push_back(round);
+    }
+    return rounds;
+  }
+
+  static std::vector<size_t> kary_children(size_t rel, size_t n, size_t k) {
+    std::vector<size_t> children;
+    for (size_t c = rel * k + 1; c <= rel * k + k && c < n; c++)
+      children.push_back(c);
+    return children;
+  }
+
+  // Every rank that has the data keeps sending it to the next rank that
+  // does not, one send per step; a message sent at step t arrives at step
+  // t + latency. Ties go to the lower rank, so all ranks agree on the tree.
+  static std::vector<size_t> fibonacci_children(size_t rel, size_t n, size_t latency) {
+    typedef std::pair<size_t, size_t> slot;
+    std::priority_queue<slot, std::vector<slot>, std::greater<slot>> ready;
+    ready.push(slot(0, 0));
+    std::vector<size_t> children;
+    for (size_t next = 1; next < n; next++) {
+      slot s = ready.top();
+      ready.pop();
+      if (s.second == rel)
+        children.push_back(next);
+      ready.push(slot(s.first + 1, s.second));
+      ready.push(slot(s.first + latency, next));
+    }
+    return children;
+  }
+
+  // Parents of relative ranks 1 .. rel in the same schedule, by replaying
+  // it only until `rel` is reached.
+  static std::vector<size_t> fibonacci_parents(size_t rel, size_t n, size_t latency) {
+    typedef std::pair<size_t, size_t> slot;
+    std::priority_queue<slot, std::vector<slot>, std::greater<slot>> ready;
+    ready.push(slot(0, 0));
+    std::vector<size_t> parents(rel + 1, 0);
+    for (size_t next = 1; next <= rel && next < n; next++) {
+      slot s = ready.top();
+      ready.pop();
+      parents[next] = s.second;
+      ready.push(slot(s.first + 1, s.second));
+      ready.push(slot(s.first + latency, next));
+    }
+    return parents;
+  }
+};
+
+// Tree policies, for the TreePolicy parameter of broadcast_data and
+// collective: rounds(), children() and ancestors() as in bcast_tree. A
+// bcast_tree is the policy whose shape and radix are set at run time; these
+// fix them at compile time.
+template <tree_shape Shape, size_t Radix>
+struct fixed_tree {
+  static bcast_tree tree() {
+    bcast_tree t;
+    t.shape = Shape;
+    t.radix = Radix;
+    return t;
+  }
+
+  static std::vector<std::vector<size_t>> rounds(size_t root, size_t me, size_t n) {
+    return tree().rounds(root, me, n);
+  }
+
+  static std::vector<size_t> children(size_t root, size_t me, size_t n) {
+    return tree().children(root, me, n);
+  }
+
+  static std::vector<size_t> ancestors(size_t root, size_t me, size_t n) {
+    return tree().ancestors(root, me, n);
+  }
+
+  bool operator==(const fixed_tree&) const {
+    return true;
+  }
+};
+
+struct binary_split_tree : fixed_tree<tree_shape::binary_split, 2> {};
+
+template <size_t K>
+struct knomial_tree : fixed_tree<tree_shape::knomial, K> {
+  static_assert(K >= 2, "a k-nomial tree needs a radix of at least 2");
+};
+
+template <size_t K>
+struct kary_tree : fixed_tree<tree_shape::kary, K> {
+  static_assert(K >= 1, "a k-ary tree needs a radix of at least 1");
+};
+
+// Latency in send overheads, as bcast_tree's radix for fibonacci.
+template <size_t Latency>
+struct fibonacci_tree : fixed_tree<tree_shape::fibonacci, Latency> {};